@@ -1,5 +1,6 @@
 #include "arraymalloc.h"
 #include <stdlib.h>
+#include <string.h>
 
 void **arraymalloc2d(int nx, int ny, size_t typesize)
 {
@@ -27,3 +28,137 @@ void **arraymalloc2d(int nx, int ny, size_t typesize)
 
   return array2d;
 }
+
+// number of elements in a padded row of ny elements: a whole number
+// of cache lines, and never a multiple of 8 lines so that successive
+// rows do not all map onto the same few cache sets
+
+int arraypad2d(int ny, size_t typesize)
+{
+  int nypad = ny;
+
+  while ((nypad*typesize) % ARRAYALIGN != 0) nypad++;
+
+  if (((nypad*typesize)/ARRAYALIGN) % 8 == 0)
+    {
+      do
+	{
+	  nypad++;
+	}
+      while ((nypad*typesize) % ARRAYALIGN != 0);
+    }
+
+  return nypad;
+}
+
+// as arraymalloc2d, but every row starts on an ARRAYALIGN boundary and
+// is padded as in arraypad2d. The result can still be freed with free().
+// If firsttouch is set the rows are zeroed by the threads that will
+// later work on them, so that pages are placed on their NUMA node
+
+void **arraymalloc2daligned(int nx, int ny, size_t typesize, int firsttouch)
+{
+  int i;
+  void **array2d;
+  char *data;
+
+  size_t tablesize, rowsize;
+
+  // round the pointer table up so the data is aligned as well
+
+  tablesize = nx*sizeof(void *);
+  tablesize = ((tablesize + ARRAYALIGN - 1)/ARRAYALIGN)*ARRAYALIGN;
+
+  rowsize = arraypad2d(ny, typesize)*typesize;
+
+  if (posix_memalign((void **) &array2d, ARRAYALIGN,
+		     tablesize + nx*rowsize) != 0)
+    {
+      return NULL;
+    }
+
+  data = ((char *) array2d) + tablesize;
+
+  for(i=0; i < nx; i++)
+    {
+      array2d[i] = (void *) (data + i*rowsize);
+    }
+
+  if (firsttouch)
+    {
+#pragma omp parallel for schedule(static)
+      for(i=0; i < nx; i++)
+	{
+	  memset(array2d[i], 0, rowsize);
+	}
+    }
+
+  return array2d;
+}
+
+// an aligned nx x ny array surrounded by halo points on every side,
+// indexed from 1-halo to nx+halo and 1-halo to ny+halo. For halo=1
+// this is arraymalloc2daligned(nx+2,ny+2,...); in general it must be
+// freed with arrayfree2dhalo()
+
+void **arraymalloc2dhalo(int nx, int ny, int halo, size_t typesize,
+			 int firsttouch)
+{
+  int i;
+  void **array2d;
+
+  array2d = arraymalloc2daligned(nx+2*halo, ny+2*halo, typesize, firsttouch);
+
+  if (array2d == NULL) return NULL;
+
+  // shift rows and row pointers so that index 1 is the first interior
+  // point
+
+  for(i=0; i < nx+2*halo; i++)
+    {
+      array2d[i] = (void *) (((char *) array2d[i]) + (halo-1)*typesize);
+    }
+
+  return array2d + (halo-1);
+}
+
+void arrayfree2dhalo(void **array2d, int halo)
+{
+  free(array2d - (halo-1));
+}
+
+// two nx x ny arrays with halos of width 1 whose rows alternate in
+// memory, row i of the second directly after row i of the first, so
+// that a stencil over both reads a single stream. Both are indexed
+// from 0 to nx+1 and 0 to ny+1. The second is returned in *second;
+// freeing the first with free() or arrayfree2dhalo() frees both
+
+void **arraymalloc2dpair(int nx, int ny, size_t typesize, int firsttouch,
+			 void ***second)
+{
+  int i;
+  void **array2d;
+  char *data;
+
+  size_t rowsize;
+
+  array2d = arraymalloc2daligned(2*(nx+2), ny+2, typesize, firsttouch);
+
+  if (array2d == NULL) return NULL;
+
+  rowsize = arraypad2d(ny+2, typesize)*typesize;
+
+  data = (char *) array2d[0];
+
+  // the first nx+2 pointers are the even rows, the rest the odd ones
+
+  for(i=0; i < nx+2; i++)
+    {
+      array2d[i]      = (void *) (data + (2*i)*rowsize);
+      array2d[nx+2+i] = (void *) (data + (2*i+1)*rowsize);
+    }
+
+  *second = array2d + nx+2;
+
+  return array2d;
+}
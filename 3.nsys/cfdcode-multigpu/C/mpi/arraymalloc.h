@@ -1,4 +1,19 @@
 #include <stddef.h>
 
+// alignment of rows returned by arraymalloc2daligned, one cache line
+
+#define ARRAYALIGN 64
+
 void **arraymalloc2d(int nx, int ny, size_t typesize);
 
+void **arraymalloc2daligned(int nx, int ny, size_t typesize, int firsttouch);
+
+int arraypad2d(int ny, size_t typesize);
+
+void **arraymalloc2dhalo(int nx, int ny, int halo, size_t typesize,
+			 int firsttouch);
+
+void arrayfree2dhalo(void **array2d, int halo);
+
+void **arraymalloc2dpair(int nx, int ny, size_t typesize, int firsttouch,
+			 void ***second);
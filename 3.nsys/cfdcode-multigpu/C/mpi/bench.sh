@@ -0,0 +1,264 @@
+#!/bin/bash
+#
+# strong and weak scaling benchmark of the C MPI cfd code and of the
+# Fortran jacobi-mpi-sendrecv of the Score-P lab, on one box with
+# mpirun -np. Every run appends a line to a CSV file, tagged with an id
+# for this invocation of the script and the extra cfd options, and
+# efficiency tables are printed at the end from the lines of this
+# invocation only
+#
+# usage: bench.sh [options]
+#   -c CODES    codes to run, default "cfd jacobi"
+#   -m MODES    scaling modes, default "strong weak"
+#   -n NPS      process counts, default "1 2 4"
+#   -t THREADS  OpenMP threads per process (cfd only), default "1"
+#   -s SCALES   cfd scale factors, default "4"; for weak scaling the
+#               scale is for one process and grows as sqrt(np), rounded,
+#               and a process count whose scale does not grow is skipped
+#   -i ITERS    cfd iterations, default 2000
+#   -g NX       jacobi grid is NX x NX (per process in x for weak), default 512
+#   -a ARGS     extra cfd options, e.g. "-s sor" or "-k 4"
+#   -o FILE     CSV file, default bench.csv, appended to
+#   -R ID       run id of the CSV lines, default the date and time
+#   -r CMD      mpirun command, default "mpirun --oversubscribe"
+#
+# The bandwidth and flop rates are from a model of the kernels, not
+# measured: cfd Jacobi reads psi and writes psinew, 2 words and 8 flops
+# a point (update and squared change); jacobi-mpi-sendrecv also works
+# out the residual and copies the grid back, 5 words and 12 flops. There
+# is no model for the other cfd smoothers, whose iteration is a sweep,
+# V-cycle or CG step, so their GB/s and GFLOP/s are left empty. The halo
+# time is the total over the iterations, mean over the ranks, from cfd -T
+# and from the halo exchange timer of jacobi-mpi-sendrecv
+
+set -e
+
+CODES="cfd jacobi"
+MODES="strong weak"
+NPS="1 2 4"
+THREADS="1"
+SCALES="4"
+ITERS=2000
+NX=512
+CFDARGS=""
+CSV=bench.csv
+MPIRUN="mpirun --oversubscribe"
+RUNID=$(date +%Y%m%dT%H%M%S)-$$
+
+while getopts "c:m:n:t:s:i:g:a:o:r:R:h" opt
+do
+  case $opt in
+    c) CODES="$OPTARG" ;;
+    m) MODES="$OPTARG" ;;
+    n) NPS="$OPTARG" ;;
+    t) THREADS="$OPTARG" ;;
+    s) SCALES="$OPTARG" ;;
+    i) ITERS="$OPTARG" ;;
+    g) NX="$OPTARG" ;;
+    a) CFDARGS="$OPTARG" ;;
+    o) CSV="$OPTARG" ;;
+    r) MPIRUN="$OPTARG" ;;
+    R) RUNID="$OPTARG" ;;
+    *) sed -n '2,/^$/s/^# \{0,1\}//p' "$0"; exit 1 ;;
+  esac
+done
+
+# root can only run mpirun with this set, for Open MPI
+
+if [ "$(id -u)" = 0 ]; then
+  export OMPI_ALLOW_RUN_AS_ROOT=1 OMPI_ALLOW_RUN_AS_ROOT_CONFIRM=1
+fi
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+FSRC=$HERE/../../../../2.scorep/solution/8.serialization/3.optimize/jacobi-mpi-sendrecv.f90
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# builds
+
+if [[ " $CODES " == *" cfd "* ]]; then
+  make -s -C "$HERE" cfd >/dev/null
+fi
+
+if [[ " $CODES " == *" jacobi "* ]]; then
+
+  # the Score-P user regions become no-ops without Score-P
+
+  mkdir -p "$WORK/scorep"
+  cat > "$WORK/scorep/SCOREP_User.inc" <<'EOF'
+#define SCOREP_USER_REGION_DEFINE(handle)
+#define SCOREP_USER_REGION_BEGIN(handle, name, type)
+#define SCOREP_USER_REGION_END(handle)
+EOF
+  mpif90 -O3 -cpp -I"$WORK" "$FSRC" -o "$WORK/jacobi"
+fi
+
+# the run id and cfd options go in the last two columns, without commas
+
+HEADER="code,mode,scale,np,threads,points,iters,time_s,iter_s,gbs,gflops,halo_s,run,args"
+RUNID=${RUNID//,/ }
+ARGS=${CFDARGS//,/ }
+
+if [ ! -s "$CSV" ]; then
+  echo "$HEADER" > "$CSV"
+elif [ "$(head -n 1 "$CSV")" != "$HEADER" ]; then
+  echo "$CSV has other columns, from an older bench.sh; use -o for a new file" >&2
+  exit 1
+fi
+
+# model words and flops per point per iteration
+
+WORD=8
+
+# run cfd with np processes and nt threads at scale sc and add its line;
+# the smoother is the one cfd reports it is using
+
+runcfd()
+{
+  local mode=$1 sc=$2 np=$3 nt=$4
+  local out points
+
+  out=$(cd "$WORK" && OMP_NUM_THREADS=$nt $MPIRUN -np "$np" "$HERE/cfd" -T $CFDARGS "$sc" "$ITERS")
+
+  points=$((1024*32*sc*sc))
+
+  echo "$out" | awk -v code=cfd -v mode="$mode" -v sc="$sc" -v np="$np" -v nt="$nt" \
+                    -v points="$points" -v word=$WORD -v run="$RUNID" -v args="$ARGS" '
+    /^Using /              { sm    = $2; sub(",", "", sm) }
+    /^After .* iterations/ { iters = $2 }
+    /^Time for/            { time  = $6 }
+    /^Each iteration took/ { iter  = $4 }
+    /^halo /               { halo  = $4 }
+    END {
+      if (iter == "") exit 1
+      gbs = gflops = ""
+      if (sm == "jacobi")
+        {
+          gbs    = sprintf("%.3f", 2*word*points/iter/1e9)
+          gflops = sprintf("%.3f", 8*points/iter/1e9)
+        }
+      printf "%s,%s,%d,%d,%d,%d,%d,%g,%g,%s,%s,%g,%s,%s\n", code, mode, sc, np, nt, points,
+             iters, time, iter, gbs, gflops, halo, run, args
+    }' >> "$CSV"
+}
+
+# run jacobi-mpi-sendrecv on an nx x ny grid; it stops at convergence
+# or after 5000 iterations, and its time includes the set up
+
+runjacobi()
+{
+  local mode=$1 nx=$2 ny=$3 np=$4
+  local out
+
+  out=$(cd "$WORK" && OMP_NUM_THREADS=1 $MPIRUN -np "$np" "$WORK/jacobi" "$nx" "$ny")
+
+  echo "$out" | awk -v code=jacobi -v mode="$mode" -v np="$np" \
+                    -v points=$((nx*ny)) -v nx="$nx" -v word=$WORD -v run="$RUNID" '
+    /Terminated on/ {
+      for (i=1; i<=NF; i++)
+        {
+          if ($i == "on")         iters = $(i+1)
+          if ($i ~ /^runtime=/)   { time = $i; sub("runtime=", "", time); if (time == "") time = $(i+1) }
+        }
+    }
+    /halotime=/ {
+      for (i=1; i<=NF; i++)
+        {
+          if ($i ~ /^halotime=/)  { halo = $i; sub("halotime=", "", halo); if (halo == "") halo = $(i+1) }
+        }
+    }
+    END {
+      if (iters == "") exit 1
+      iter = time/iters
+      printf "%s,%s,%d,%d,%d,%d,%d,%g,%g,%.3f,%.3f,%g,%s,\n", code, mode, nx, np, 1, points,
+             iters, time, iter, 5*word*points/iter/1e9, 12*points/iter/1e9, halo, run
+    }' >> "$CSV"
+}
+
+# scale and process count of the last weak cfd run of each series
+
+declare -A weakscale weaknp
+
+for mode in $MODES; do
+  for np in $NPS; do
+
+    if [[ " $CODES " == *" cfd "* ]]; then
+      for sc in $SCALES; do
+        for nt in $THREADS; do
+
+          # weak scaling keeps the points per process about the same; the
+          # scale is a whole number, so a small one may not grow with np,
+          # and then the run would be strong scaling under a weak label
+
+          if [ "$mode" = weak ]; then
+            s=$(awk -v s="$sc" -v p="$np" 'BEGIN { printf "%d", s*sqrt(p) + 0.5 }')
+            if [ "${weakscale[$sc.$nt]}" = "$s" ]; then
+              echo "cfd weak: scale $s on $np process(es) is the same as on ${weaknp[$sc.$nt]}, skipped;" \
+                   "use a larger -s" >&2
+              continue
+            fi
+            weakscale[$sc.$nt]=$s
+            weaknp[$sc.$nt]=$np
+          else
+            s=$sc
+          fi
+
+          echo "cfd $mode: scale $s, $np process(es), $nt thread(s)"
+          runcfd "$mode" "$s" "$np" "$nt"
+        done
+      done
+    fi
+
+    if [[ " $CODES " == *" jacobi "* ]]; then
+      if [ "$mode" = weak ]; then nx=$((NX*np)); else nx=$NX; fi
+
+      echo "jacobi $mode: $nx x $NX grid, $np process(es)"
+      runjacobi "$mode" "$nx" "$NX" "$np"
+    fi
+  done
+done
+
+# efficiency against the run with the fewest processes of each series,
+# from the time per point per process, so the same for strong and weak
+# scaling: E = (T0 np0 / points0) / (T np / points). Lines of earlier
+# invocations, maybe with other options, are left out
+
+echo
+echo "run $RUNID${CFDARGS:+, cfd options $CFDARGS}"
+awk -F, -v run="$RUNID" '
+  NR == 1 || $13 != run { next }
+  {
+    series = $1 " " $2 " threads=" $5 (($2 == "strong") ? " size=" $3 : "")
+    if (!(series in base) || $4 < basenp[series])
+      {
+        base[series]   = $9*$4/$6
+        basenp[series] = $4
+      }
+    if (!(series in seen))
+      {
+        seen[series] = 1
+        order[++nseries] = series
+      }
+    n++
+    line[n] = $0
+    ser[n]  = series
+  }
+  END {
+    printf "%-36s %5s %9s %12s %9s %9s %9s %8s\n",
+           "series", "np", "points", "iter (s)", "GB/s", "GFLOP/s", "speedup", "eff"
+    for (s=1; s<=nseries; s++)
+      {
+        for (k=1; k<=n; k++)
+          {
+            if (ser[k] != order[s]) continue
+            split(line[k], f, ",")
+            cost = f[9]*f[4]/f[6]
+            gbs    = (f[10] == "") ? "-" : sprintf("%.2f", f[10])
+            gflops = (f[11] == "") ? "-" : sprintf("%.2f", f[11])
+            printf "%-36s %5d %9d %12.4g %9s %9s %9.2f %7.1f%%\n",
+                   ser[k], f[4], f[6], f[9], gbs, gflops,
+                   base[ser[k]]*f[4]/cost/basenp[ser[k]], 100*base[ser[k]]/cost
+          }
+      }
+  }' "$CSV"
@@ -1,104 +1,384 @@
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
 #include <mpi.h>
 
+#include "precision.h"
+#include "decomp.h"
 #include "boundary.h"
+#include "timer.h"
 
-//grid is parallelised in the x direction
+//grid is parallelised in both the x and y directions
 
-void boundarypsi(double **psi, int m, int n,
-		 int b, int h, int w, MPI_Comm comm)
+void boundarypsi(Float_t **psi, int b, int h, int w, const decomp *dc)
 {
+  int i,j;
+  int istart, istop, jstart, jstop;
 
-  int size, rank,i,j;
-  int istart, istop;
-
-  MPI_Comm_size(comm,&size);
-  MPI_Comm_rank(comm,&rank);
-
-  istart = m*rank + 1;
-  istop = istart + m -1;
+  istart = dc->istart;
+  istop  = istart + dc->lm - 1;
+  jstart = dc->jstart;
+  jstop  = jstart + dc->ln - 1;
 
   //BCs on bottom edge
 
-  for (i=b+1;i<=b+w-1;i++)
+  if (dc->coords[1] == 0)
     {
-      if (i >= istart && i <= istop)
+      for (i=b+1;i<=b+w-1;i++)
 	{
-	  psi[i-istart+1][0] = (double)(i-b);
-        }
-    }
+	  if (i >= istart && i <= istop)
+	    {
+	      psi[i-istart+1][0] = (double)(i-b);
+	    }
+	}
 
-  for (i=b+w;i<=m*size;i++)
-    {
-      if (i >= istart && i <= istop)
+      for (i=b+w;i<=dc->m;i++)
 	{
-	  psi[i-istart+1][0] = (double)(w);
+	  if (i >= istart && i <= istop)
+	    {
+	      psi[i-istart+1][0] = (double)(w);
+	    }
 	}
     }
 
   //BCS on RHS
 
-  if (rank == size-1)
+  if (dc->coords[0] == dc->dims[0]-1)
     {
       for (j=1; j <= h; j++)
 	{
-	  psi[m+1][j] = (double) w;
+	  if (j >= jstart && j <= jstop)
+	    {
+	      psi[dc->lm+1][j-jstart+1] = (double) w;
+	    }
 	}
 
       for (j=h+1;j<=h+w-1; j++)
 	{
-	  psi[m+1][j]=(double)(w-j+h);
+	  if (j >= jstart && j <= jstop)
+	    {
+	      psi[dc->lm+1][j-jstart+1]=(double)(w-j+h);
+	    }
 	}
     }
 }
 
-void haloswap(double **x, int m, int n, MPI_Comm comm)
+//the zeta boundary conditions depend on psi, so are set again after
+//every update. Only the edges of the block on the edge of the grid
+
+void boundaryzet(Float_t **zet, Float_t **psi, const decomp *dc)
 {
-  int rank, size;
-  int tag=1;
+  int i,j;
 
-  MPI_Status status;
+  int m = dc->lm;
+  int n = dc->ln;
 
-  MPI_Comm_rank(comm,&rank);
-  MPI_Comm_size(comm,&size);
+  //set top/bottom BCs:
 
+  for (i=1;i<m+1;i++)
+    {
+      if (dc->down == MPI_PROC_NULL) zet[i][0]   = 2.0*(psi[i][1]-psi[i][0]);
+      if (dc->up   == MPI_PROC_NULL) zet[i][n+1] = 2.0*(psi[i][n]-psi[i][n+1]);
+    }
 
-  //no need to halo swap if serial:
+  //set left BCs:
 
-  if (size > 1)
+  if (dc->left == MPI_PROC_NULL)
     {
-      //send right boundaries and receive left ones
-
-      if (rank == 0)
+      for (j=1;j<n+1;j++)
 	{
-	  MPI_Send(&x[m][1],n,MPI_DOUBLE,rank+1,tag,comm);
+	  zet[0][j] = 2.0*(psi[1][j]-psi[0][j]);
 	}
-      else if (rank == size-1)
+    }
+
+  //set right BCs
+
+  if (dc->right == MPI_PROC_NULL)
+    {
+      for (j=1;j<n+1;j++)
 	{
-	  MPI_Recv(&x[0][1],n,MPI_DOUBLE,rank-1,tag,comm,&status);
+	  zet[m+1][j] = 2.0*(psi[m][j]-psi[m+1][j]);
 	}
-      else
+    }
+}
+
+//the halo swaps use the same buffers and partners every iteration, so
+//their requests are persistent: created once per array with
+//MPI_Send_init/MPI_Recv_init and then only started and completed.
+//Jacobi alternates between two arrays and the solvers keep a few work
+//arrays, so the requests are kept in a small cache, keyed by everything
+//that determines the messages. The least recently used entry is
+//replaced when it is full; it cannot be in flight, as only one swap is
+//ever in progress at a time
+
+#define HALONCACHE 64
+
+enum {HALOSPLIT, HALOPAIR, HALOCORNERS, HALODEEP};
+
+typedef struct
+{
+  int          kind;
+  Float_t      *x0;        //first row of the array
+  ptrdiff_t    stride;     //distance between its rows
+  MPI_Comm     comm;
+  MPI_Datatype coltype, rowtype;
+  int          lm, ln, hw;
+  int          nbr[4];
+  long         lastuse;
+  MPI_Request  req[HALONREQ];
+} halocache;
+
+static halocache cache[HALONCACHE];
+static int  ncache = 0;
+static long nuse   = 0;
+
+static int halomatch(const halocache *hc, Float_t **x, const decomp *dc,
+		     int kind)
+{
+  return hc->kind == kind && hc->x0 == x[0] && hc->stride == x[1]-x[0] &&
+    hc->comm == dc->comm && hc->coltype == dc->coltype &&
+    hc->rowtype == dc->rowtype && hc->lm == dc->lm && hc->ln == dc->ln &&
+    hc->hw == dc->hw && hc->nbr[0] == dc->left && hc->nbr[1] == dc->right &&
+    hc->nbr[2] == dc->down && hc->nbr[3] == dc->up;
+}
+
+//create the persistent requests of a swap. For the swaps with corners
+//the first four are the columns and the last four the rows, which must
+//be done in that order
+
+static void haloinit(MPI_Request *req, Float_t **x, const decomp *dc,
+		     int kind)
+{
+  int m  = dc->lm;
+  int n  = dc->ln;
+  int hw = dc->hw;
+  int tag=1;
+
+  switch (kind)
+    {
+    case HALOSPLIT:
+
+      //neighbours at the edges of the grid are MPI_PROC_NULL, so no
+      //special cases. Rows are contiguous, columns use a derived type.
+      //The receives come first so that the sends can match straight away
+
+      MPI_Recv_init(&x[0][1],  n,MPI_FLOAT_T,  dc->left, tag,dc->comm,&req[0]);
+      MPI_Recv_init(&x[m+1][1],n,MPI_FLOAT_T,  dc->right,tag,dc->comm,&req[1]);
+      MPI_Recv_init(&x[1][0],  1,dc->coltype, dc->down, tag,dc->comm,&req[2]);
+      MPI_Recv_init(&x[1][n+1],1,dc->coltype, dc->up,   tag,dc->comm,&req[3]);
+
+      //send right, left, top and bottom boundaries
+
+      MPI_Send_init(&x[m][1],  n,MPI_FLOAT_T,  dc->right,tag,dc->comm,&req[4]);
+      MPI_Send_init(&x[1][1],  n,MPI_FLOAT_T,  dc->left, tag,dc->comm,&req[5]);
+      MPI_Send_init(&x[1][n],  1,dc->coltype, dc->up,   tag,dc->comm,&req[6]);
+      MPI_Send_init(&x[1][1],  1,dc->coltype, dc->down, tag,dc->comm,&req[7]);
+      break;
+
+    case HALOPAIR:
+
+      MPI_Recv_init(&x[0][1],  1,dc->pairrowtype,dc->left, tag,dc->comm,&req[0]);
+      MPI_Recv_init(&x[m+1][1],1,dc->pairrowtype,dc->right,tag,dc->comm,&req[1]);
+      MPI_Recv_init(&x[1][0],  1,dc->paircoltype,dc->down, tag,dc->comm,&req[2]);
+      MPI_Recv_init(&x[1][n+1],1,dc->paircoltype,dc->up,   tag,dc->comm,&req[3]);
+
+      MPI_Send_init(&x[m][1],  1,dc->pairrowtype,dc->right,tag,dc->comm,&req[4]);
+      MPI_Send_init(&x[1][1],  1,dc->pairrowtype,dc->left, tag,dc->comm,&req[5]);
+      MPI_Send_init(&x[1][n],  1,dc->paircoltype,dc->up,   tag,dc->comm,&req[6]);
+      MPI_Send_init(&x[1][1],  1,dc->paircoltype,dc->down, tag,dc->comm,&req[7]);
+      break;
+
+    case HALOCORNERS:
+
+      MPI_Recv_init(&x[1][0],  1,dc->coltype,dc->down, tag,dc->comm,&req[0]);
+      MPI_Recv_init(&x[1][n+1],1,dc->coltype,dc->up,   tag,dc->comm,&req[1]);
+      MPI_Send_init(&x[1][n],  1,dc->coltype,dc->up,   tag,dc->comm,&req[2]);
+      MPI_Send_init(&x[1][1],  1,dc->coltype,dc->down, tag,dc->comm,&req[3]);
+
+      MPI_Recv_init(&x[0][0],  1,dc->rowtype,dc->left, tag,dc->comm,&req[4]);
+      MPI_Recv_init(&x[m+1][0],1,dc->rowtype,dc->right,tag,dc->comm,&req[5]);
+      MPI_Send_init(&x[m][0],  1,dc->rowtype,dc->right,tag,dc->comm,&req[6]);
+      MPI_Send_init(&x[1][0],  1,dc->rowtype,dc->left, tag,dc->comm,&req[7]);
+      break;
+
+    case HALODEEP:
+
+      //deep halos are used for several steps, so the corners are
+      //needed as well. Columns run from row 0 to m+1, and rows include
+      //the column halos
+
+      MPI_Recv_init(&x[0][1-hw],   1,dc->coltype,dc->down, tag,dc->comm,&req[0]);
+      MPI_Recv_init(&x[0][n+1],    1,dc->coltype,dc->up,   tag,dc->comm,&req[1]);
+      MPI_Send_init(&x[0][n-hw+1], 1,dc->coltype,dc->up,   tag,dc->comm,&req[2]);
+      MPI_Send_init(&x[0][1],      1,dc->coltype,dc->down, tag,dc->comm,&req[3]);
+
+      MPI_Recv_init(&x[1-hw][1-hw],  1,dc->rowtype,dc->left, tag,dc->comm,&req[4]);
+      MPI_Recv_init(&x[m+1][1-hw],   1,dc->rowtype,dc->right,tag,dc->comm,&req[5]);
+      MPI_Send_init(&x[m-hw+1][1-hw],1,dc->rowtype,dc->right,tag,dc->comm,&req[6]);
+      MPI_Send_init(&x[1][1-hw],     1,dc->rowtype,dc->left, tag,dc->comm,&req[7]);
+      break;
+    }
+}
+
+//the persistent requests of a swap of x, created if need be
+
+static MPI_Request *halorequests(Float_t **x, const decomp *dc, int kind)
+{
+  halocache *hc;
+  int i, k;
+
+  nuse++;
+
+  for (k=0; k<ncache; k++)
+    {
+      if (halomatch(&cache[k],x,dc,kind))
 	{
-	  MPI_Sendrecv(&x[m][1],n,MPI_DOUBLE,rank+1,tag,
-		       &x[0][1],n,MPI_DOUBLE,rank-1,tag,
-		       comm,&status);
+	  cache[k].lastuse = nuse;
+	  return cache[k].req;
 	}
+    }
 
-      //send left boundary and receive right
+  if (ncache < HALONCACHE)
+    {
+      hc = &cache[ncache++];
+    }
+  else
+    {
+      hc = &cache[0];
 
-      if (rank == 0)
+      for (k=1; k<HALONCACHE; k++)
 	{
-	  MPI_Recv(&x[m+1][1],n,MPI_DOUBLE,rank+1,tag,comm,&status);
+	  if (cache[k].lastuse < hc->lastuse) hc = &cache[k];
 	}
-      else if (rank == size-1)
+
+      for (i=0; i<HALONREQ; i++)
 	{
-	  MPI_Send(&x[1][1],  n,MPI_DOUBLE,rank-1,tag,comm);
+	  MPI_Request_free(&hc->req[i]);
 	}
-      else
+    }
+
+  hc->kind    = kind;
+  hc->x0      = x[0];
+  hc->stride  = x[1]-x[0];
+  hc->comm    = dc->comm;
+  hc->coltype = dc->coltype;
+  hc->rowtype = dc->rowtype;
+  hc->lm      = dc->lm;
+  hc->ln      = dc->ln;
+  hc->hw      = dc->hw;
+  hc->nbr[0]  = dc->left;
+  hc->nbr[1]  = dc->right;
+  hc->nbr[2]  = dc->down;
+  hc->nbr[3]  = dc->up;
+  hc->lastuse = nuse;
+
+  haloinit(hc->req,x,dc,kind);
+
+  return hc->req;
+}
+
+//release all the persistent requests; call before the communicators
+//and arrays they refer to are freed
+
+void halofree(void)
+{
+  int i, k;
+
+  for (k=0; k<ncache; k++)
+    {
+      for (i=0; i<HALONREQ; i++)
 	{
-	  MPI_Sendrecv(&x[1][1],  n,MPI_DOUBLE,rank-1,tag,
-		       &x[m+1][1],n,MPI_DOUBLE,rank+1,tag,
-		       comm,&status);
+	  MPI_Request_free(&cache[k].req[i]);
 	}
     }
+
+  ncache = 0;
+}
+
+//the halo swap is split into two phases so that work that does not
+//depend on the halos can be done while the messages are in flight.
+//req must have room for HALONREQ requests, and gets copies of the
+//persistent handles. This is only for halos of width 1, where the
+//stencil does not need the corners
+
+void haloswapbegin(Float_t **x, const decomp *dc, MPI_Request *req)
+{
+  MPI_Request *preq = halorequests(x,dc,HALOSPLIT);
+
+  timerstart(TIMERHALO);
+
+  memcpy(req,preq,HALONREQ*sizeof(MPI_Request));
+
+  MPI_Startall(HALONREQ,req);
+
+  timerstop(TIMERHALO);
+}
+
+//completing a persistent request leaves it inactive, ready to be
+//started again, so this works for either kind of request
+
+void haloswapend(MPI_Request *req)
+{
+  timerstart(TIMERHALO);
+
+  MPI_Waitall(HALONREQ,req,MPI_STATUSES_IGNORE);
+
+  timerstop(TIMERHALO);
+}
+
+//swap in two steps, columns then rows, so that the corners are filled
+
+static void haloswaptwostep(Float_t **x, const decomp *dc, int kind)
+{
+  MPI_Request *req = halorequests(x,dc,kind);
+
+  timerstart(TIMERHALO);
+
+  MPI_Startall(4,&req[0]);
+  MPI_Waitall(4,&req[0],MPI_STATUSES_IGNORE);
+
+  MPI_Startall(4,&req[4]);
+  MPI_Waitall(4,&req[4],MPI_STATUSES_IGNORE);
+
+  timerstop(TIMERHALO);
+}
+
+void haloswap(Float_t **x, const decomp *dc)
+{
+  MPI_Request req[HALONREQ];
+
+  if (dc->hw == 1)
+    {
+      haloswapbegin(x,dc,req);
+      haloswapend(req);
+    }
+  else
+    {
+      haloswaptwostep(x,dc,HALODEEP);
+    }
+}
+
+//as haloswap() for a halo of width 1, but also filling in the corners
+//of the halo, which interpolation from the block needs. The columns
+//are swapped first, then the rows including the column halos
+
+void haloswapcorners(Float_t **x, const decomp *dc)
+{
+  haloswaptwostep(x,dc,HALOCORNERS);
+}
+
+//split-phase swap of two arrays from arraymalloc2dpair at once, x
+//being the first. Same messages as haloswapbegin, each twice as long
+
+void haloswappairbegin(Float_t **x, const decomp *dc, MPI_Request *req)
+{
+  MPI_Request *preq = halorequests(x,dc,HALOPAIR);
+
+  timerstart(TIMERHALO);
+
+  memcpy(req,preq,HALONREQ*sizeof(MPI_Request));
+
+  MPI_Startall(HALONREQ,req);
+
+  timerstop(TIMERHALO);
 }
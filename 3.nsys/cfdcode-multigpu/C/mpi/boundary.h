@@ -1,6 +1,19 @@
-void boundarypsi(double **psi, int m, int n, int b, int h, int w,
-		 MPI_Comm comm);
+void boundarypsi(Float_t **psi, int b, int h, int w, const decomp *dc);
 
-void boundaryzet(double **zet, double **psi, int m, int n, MPI_Comm comm);
+void boundaryzet(Float_t **zet, Float_t **psi, const decomp *dc);
 
-void haloswap(double **x, int m, int n, MPI_Comm comm);
+//number of requests used by a split-phase halo swap
+
+#define HALONREQ 8
+
+void haloswap(Float_t **x, const decomp *dc);
+
+void haloswapbegin(Float_t **x, const decomp *dc, MPI_Request *req);
+
+void haloswapend(MPI_Request *req);
+
+void haloswapcorners(Float_t **x, const decomp *dc);
+
+void haloswappairbegin(Float_t **x, const decomp *dc, MPI_Request *req);
+
+void halofree(void);
@@ -2,24 +2,46 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <getopt.h>
 
 #include <mpi.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "arraymalloc.h"
+#include "precision.h"
+#include "decomp.h"
 #include "boundary.h"
 #include "jacobi.h"
+#include "sor.h"
+#include "smoother.h"
+#include "cg.h"
+#include "mixed.h"
 #include "cfdio.h"
+#include "checkpoint.h"
+#include "timer.h"
 
 int main(int argc, char **argv)
 {
   int printfreq=1000; //output frequency
-  double localerror, error, localbnorm, bnorm;
+  double localerror, error, localbnorm, bnorm, resid;
   double tolerance=0.0; //tolerance for convergence. <=0 means do not check
+  int checkfreq=1;      //check convergence every checkfreq iterations
+
+  //the global error is reduced in the background, and only used one
+  //iteration after it was started
+  double errlocal, errglobal;
+  int erriter, newerr, haveerr;
+  MPI_Request errreq = MPI_REQUEST_NULL;
 
   //main arrays
-  double **psi;
+  Float_t **psi;
   //temporary versions of main arrays
-  double **psitmp;
+  Float_t **psitmp;
+  //vorticity and its temporary version, if the flow is not irrotational
+  Float_t **zet = NULL, **zettmp = NULL;
 
   //command line arguments
   int scalefactor, numiter;
@@ -35,55 +57,236 @@ int main(int argc, char **argv)
 
   int irrotational = 1, checkerr = 0;
 
-  int m,n,lm,b,h,w;
-  int iter;
+  int m,n,lm,ln,b,h,w;
+  int iter, iter0, niter, nstep;
+
+  //number of iterations per halo swap, and so the halo depth
+  int depth = 1;
+
+  //float sweeps per refinement of the mixed precision smoother
+  int refine = 16;
+
+  //iterative method, and its over-relaxation parameter; omega <= 0
+  //means use the optimal value for SOR
+  const smoother *sm;
+  char *smname = "jacobi";
+  double omega = 0.0;
+
+  //binary output file, none if NULL
+  char *outfile = NULL;
+
+  //checkpoint every chkfreq iterations if > 0, and whether to start
+  //from the latest checkpoint
+  int chkfreq = 0, restart = 0;
+  char *chkprefix = "cfd.chk";
+  checkpoint chk;
   int i,j;
 
+  //relative throughput of each process, one per line of weightfile,
+  //to size the blocks with; equal blocks if NULL
+  char *weightfile = NULL;
+  double weight = 1.0, *weights;
+  int badweights = 0, minlm, minln;
+
+  //time the regions of the hot path, and write a trace if not NULL
+  int timermode = TIMEROFF;
+  char *tracefile = NULL;
+
   double tstart, tstop, ttot, titer;
 
   //parallelisation parameters
-  int rank, size;
+  int rank, size, provided, nthread;
   MPI_Comm comm;
+  decomp dc;
 
+  comm=MPI_COMM_WORLD;
 
-  //do we stop because of tolerance?
-  if (tolerance > 0)
+  //threads only compute, all MPI calls are made by the master thread
+  //outside parallel regions
+
+  MPI_Init_thread(&argc,&argv,MPI_THREAD_FUNNELED,&provided);
+
+  MPI_Comm_rank(comm,&rank);
+  MPI_Comm_size(comm,&size);
+
+  if (provided < MPI_THREAD_FUNNELED)
     {
-      checkerr = 1;
+      if (rank == 0) printf("ERROR: MPI library does not support MPI_THREAD_FUNNELED\n");
+      MPI_Finalize();
+      return -1;
     }
 
-  comm=MPI_COMM_WORLD;
+  nthread = 1;
 
-  MPI_Init(&argc,&argv);
+#ifdef _OPENMP
+  nthread = omp_get_max_threads();
+#endif
 
-  MPI_Comm_rank(comm,&rank);
-  MPI_Comm_size(comm,&size);
+  //check command line parameters and parse them; every process parses
+  //the options, only rank 0 reports errors
 
-  //check command line parameters and parse them
+  static struct option longopts[] =
+    {
+      {"depth",  required_argument, NULL, 'k'},
+      {"output", required_argument, NULL, 'o'},
+      {"checkpoint", required_argument, NULL, 'c'},
+      {"restart",    no_argument,       NULL, 'r'},
+      {"tolerance",  required_argument, NULL, 't'},
+      {"check-interval", required_argument, NULL, 'i'},
+      {"smoother",   required_argument, NULL, 's'},
+      {"omega",      required_argument, NULL, 'w'},
+      {"precond",    required_argument, NULL, 'p'},
+      {"weights",    required_argument, NULL, 'W'},
+      {"refine",     required_argument, NULL, 'R'},
+      {"timers",     no_argument,       NULL, 'T'},
+      {"trace",      required_argument, NULL, 'j'},
+      {NULL,    0,                 NULL,  0 }
+    };
+
+  int opt, badopt = 0;
+
+  opterr = (rank == 0);
+
+  while ((opt = getopt_long(argc, argv, "k:o:c:rt:i:s:w:p:W:R:Tj:", longopts, NULL)) != -1)
+    {
+      switch (opt)
+        {
+        case 'k':
+          depth = atoi(optarg);
+          if (depth < 1) badopt = 1;
+          break;
+        case 'o':
+          outfile = optarg;
+          break;
+        case 'c':
+          chkfreq = atoi(optarg);
+          if (chkfreq < 0) badopt = 1;
+          break;
+        case 'r':
+          restart = 1;
+          break;
+        case 't':
+          tolerance = atof(optarg);
+          break;
+        case 'i':
+          checkfreq = atoi(optarg);
+          if (checkfreq < 1) badopt = 1;
+          break;
+        case 's':
+          smname = optarg;
+          break;
+        case 'w':
+          omega = atof(optarg);
+          if (omega >= 2.0) badopt = 1;
+          break;
+        case 'p':
+          if (atoi(optarg) < 0) badopt = 1;
+          cgprecondset(atoi(optarg));
+          break;
+        case 'W':
+          weightfile = optarg;
+          break;
+        case 'R':
+          refine = atoi(optarg);
+          if (refine < 1) badopt = 1;
+          break;
+        case 'T':
+          if (timermode == TIMEROFF) timermode = TIMERTOTAL;
+          break;
+        case 'j':
+          tracefile = optarg;
+          timermode = TIMERTRACE;
+          break;
+        default:
+          badopt = 1;
+        }
+    }
+
+  sm = smootherfind(smname);
 
-  if (argc <3|| argc >4)
+  if (sm == NULL)
+    {
+      if (rank == 0) printf("Unknown smoother %s\n", smname);
+      badopt = 1;
+    }
+  else if (depth > 1 && !sm->deephalo)
     {
-      if (rank == 0) printf("Usage: cfd <scale> <numiter> [reynolds]\n");
+      if (rank == 0) printf("Smoother %s needs a halo depth of 1\n", smname);
+      badopt = 1;
+    }
+  else if (argc-optind == 3 && (sm->iterate != jacobiiterate || depth > 1))
+    {
+      if (rank == 0) printf("Flow with a Reynolds number needs the jacobi smoother and a halo depth of 1\n");
+      badopt = 1;
+    }
+
+  if (badopt || argc-optind < 2 || argc-optind > 3)
+    {
+      if (rank == 0)
+        {
+          printf("Usage: cfd [options] <scale> <numiter> [reynolds]\n");
+          printf("  -k, --depth=K     iterations per halo swap (temporal blocking), default 1\n");
+          printf("  -o, --output=FILE write the final flow to a binary FILE, see cfd2dat\n");
+          printf("  -c, --checkpoint=N write a checkpoint every N iterations, files %s.*\n",chkprefix);
+          printf("  -r, --restart     continue from the latest complete checkpoint\n");
+          printf("  -t, --tolerance=TOL stop once the relative error is below TOL, default 0 (never)\n");
+          printf("  -i, --check-interval=N check the error every N iterations, default 1\n");
+          printf("  -s, --smoother=NAME iterative method, default jacobi, one of:");
+          smootherlist();
+          if (smootherfind("mixed") != NULL)
+            printf("                    mixed iterates the correction in float, see -R\n");
+          printf("  -w, --omega=W     over-relaxation for sor, W < 2, default optimal\n");
+          printf("  -p, --precond=K   Jacobi sweeps to precondition cg with, default 0\n");
+          if (smootherfind("mixed") != NULL)
+            printf("  -R, --refine=N    float sweeps per refinement for mixed, default %d\n",refine);
+          printf("  -W, --weights=FILE size blocks by the relative speed of each rank, one per line\n");
+          printf("  -T, --timers      print the time in each region of the solver over the ranks\n");
+          printf("  -j, --trace=FILE  as -T, and write a Chrome trace (chrome://tracing, Perfetto) to FILE\n");
+        }
       MPI_Finalize();
       return 0;
     }
 
+  //do we stop because of tolerance?
+  if (tolerance > 0)
+    {
+      checkerr = 1;
+    }
+
   if (rank == 0)
     {
-      scalefactor=atoi(argv[1]);
-      numiter=atoi(argv[2]);
-      re=-1.0;
- 
+      scalefactor=atoi(argv[optind]);
+      numiter=atoi(argv[optind+1]);
+
+      if (argc-optind == 2)
+        {
+          re=-1.0;
+          irrotational=1;
+        }
+      else
+        {
+          re=atof(argv[optind+2]);
+          irrotational=0;
+        }
+
       if(!checkerr)
         {
           printf("Scale Factor = %i, iterations = %i\n",scalefactor, numiter);
         }
       else
         {
-          printf("Scale Factor = %i, iterations = %i, tolerance= %g\n",scalefactor,numiter,tolerance);
+          printf("Scale Factor = %i, iterations = %i, tolerance= %g, checked every %d iteration(s)\n",
+                 scalefactor,numiter,tolerance,checkfreq);
         }
 
-      printf("Irrotational flow\n");
+      if (irrotational)
+        {
+          printf("Irrotational flow\n");
+        }
+      else
+        {
+          printf("Reynolds number = %f\n",re);
+        }
      }
 
 
@@ -102,65 +305,215 @@ int main(int argc, char **argv)
 
   re = re / (double)scalefactor;
 
-  //calculate local size
-  lm = m/size;
+  //rank 0 reads the weights and hands each process its own
+
+  if (weightfile != NULL)
+    {
+      weights = NULL;
+
+      if (rank == 0)
+        {
+          weights = (double *) malloc(size*sizeof(double));
+          badweights = readweights(weightfile,size,weights);
+        }
+
+      MPI_Bcast(&badweights,1,MPI_INT,0,comm);
+
+      if (badweights)
+        {
+          MPI_Finalize();
+          return -1;
+        }
+
+      MPI_Scatter(weights,1,MPI_DOUBLE,&weight,1,MPI_DOUBLE,0,comm);
+
+      free(weights);
+    }
+
+  //split the grid over a 2D process grid and get the local size;
+  //blocks may differ in size by one point in each direction, or are in
+  //proportion to the weights. The halo is as deep as the number of
+  //iterations done between swaps
+
+  decompcreateweighted(&dc,m,n,depth,weight,comm);
+
+  //a halo cannot be deeper than the block it comes from
 
-  //consistency check
-  if (size*lm != m)
+  MPI_Allreduce(&dc.lm,&minlm,1,MPI_INT,MPI_MIN,comm);
+  MPI_Allreduce(&dc.ln,&minln,1,MPI_INT,MPI_MIN,comm);
+
+  if (minlm < depth || minln < depth)
     {
       if (rank == 0)
         {
-          printf("ERROR: m=%d does not divide onto %d processes\n", m, size);
+          printf("ERROR: smallest block is %d x %d, less than the halo depth %d\n",
+                 minlm,minln,depth);
         }
       MPI_Finalize();
       return -1;
     }
 
-  if (rank == 0)
+  if (omega <= 0.0)
     {
-      printf("Running CFD on %d x %d grid using %d process(es) \n",m,n,size);
+      omega = soromega(m,n);
     }
 
-  //allocate arrays
-
-  psi    = (double **) arraymalloc2d(lm+2,n+2,sizeof(double));
-  psitmp = (double **) arraymalloc2d(lm+2,n+2,sizeof(double));
+  lm = dc.lm;
+  ln = dc.ln;
 
-  //zero the psi array
-  for (i=0;i<lm+2;i++)
+  if (rank == 0)
     {
-      for(j=0;j<n+2;j++)
+      printf("Running CFD on %d x %d grid using %d process(es) (%d x %d)\n",
+             m,n,size,dc.dims[0],dc.dims[1]);
+      printf("Each process uses %d thread(s)\n",nthread);
+      printf("Using %s",sm->name);
+      if (sizeof(Float_t) == sizeof(float)) printf(" in single precision");
+      if (sm->iterate == soriterate) printf(", omega = %g",omega);
+      if (sm->iterate == mixediterate) printf(", refined every %d sweeps",refine);
+      printf("\n");
+
+      if (depth > 1)
+        {
+          printf("Halo depth %d, %d iterations per halo swap\n",depth,depth);
+        }
+
+      if (weightfile != NULL)
         {
-          psi[i][j]=0.;
+          printf("Blocks weighted by %s\n",weightfile);
         }
     }
 
+  //allocate arrays with aligned, padded rows; they are zeroed in
+  //parallel so that memory is placed close to the threads using it
+
+  //psi and zeta are updated together, so their rows are interleaved
+  //and one halo swap carries both
+
+  if (irrotational)
+    {
+      psi    = (Float_t **) arraymalloc2dhalo(lm,ln,depth,sizeof(Float_t),1);
+      psitmp = (Float_t **) arraymalloc2dhalo(lm,ln,depth,sizeof(Float_t),1);
+    }
+  else
+    {
+      psi    = (Float_t **) arraymalloc2dpair(lm,ln,sizeof(Float_t),1,(void ***) &zet);
+      psitmp = (Float_t **) arraymalloc2dpair(lm,ln,sizeof(Float_t),1,(void ***) &zettmp);
+    }
+
+  if (psi == NULL || psitmp == NULL)
+    {
+      printf("ERROR: rank %d failed to allocate arrays\n", rank);
+      MPI_Abort(comm,1);
+    }
+
+  //the region timers are started by all processes together, so the
+  //traces of the processes line up
+
+  timerinit(timermode,comm);
+
   //set the psi boundary conditions
 
-  boundarypsi(psi,lm,n,b,h,w,comm);
+  boundarypsi(psi,b,h,w,&dc);
 
-  //compute normalisation factor for error
+  //carry on from a checkpoint, which holds the interior of the block,
+  //the iteration count and the normalisation factor
 
-  localbnorm=0.;
+  iter0 = 0;
+
+  if (restart)
+    {
+      timerstart(TIMERIO);
+      restart = checkpointread(chkprefix,psi,zet,&iter0,&bnorm,&dc);
+      timerstop(TIMERIO);
+
+      if (rank == 0)
+        {
+          if (restart)
+            {
+              printf("Restarting from checkpoint at iteration %d\n",iter0);
+            }
+          else
+            {
+              printf("No complete checkpoint found, starting from the beginning\n");
+            }
+        }
+    }
+
+  //the zeta boundary conditions depend on psi
+
+  if (!irrotational)
+    {
+      boundaryzet(zet,psi,&dc);
+    }
+
+  //the arrays are swapped rather than copied back each iteration, so
+  //both need the boundary conditions
 
   for (i=0;i<lm+2;i++)
     {
-      for (j=0;j<n+2;j++)
+      for (j=0;j<ln+2;j++)
+        {
+          psitmp[i][j]=psi[i][j];
+        }
+    }
+
+  if (!irrotational)
+    {
+      for (i=0;i<lm+2;i++)
+        {
+          for (j=0;j<ln+2;j++)
+            {
+              zettmp[i][j]=zet[i][j];
+            }
+        }
+    }
+
+  //compute normalisation factor for error
+
+  if (!restart)
+    {
+      localbnorm=0.;
+
+      for (i=0;i<lm+2;i++)
         {
-          localbnorm += psi[i][j]*psi[i][j];
+          for (j=0;j<ln+2;j++)
+            {
+              localbnorm += psi[i][j]*psi[i][j];
+            }
+        }
+
+      if (!irrotational)
+        {
+          for (i=0;i<lm+2;i++)
+            {
+              for (j=0;j<ln+2;j++)
+                {
+                  localbnorm += zet[i][j]*zet[i][j];
+                }
+            }
         }
+
+      //get global bnorm
+      MPI_Allreduce(&localbnorm,&bnorm,1,MPI_DOUBLE,MPI_SUM,comm);
+
+      bnorm=sqrt(bnorm);
     }
 
-  //boundary swap of psi
+  //checkpoints are written by a background thread
 
-  haloswap(psi,lm,n,comm);
+  if (chkfreq > 0)
+    {
+      checkpointstart(&chk,chkprefix,irrotational ? 1 : 2,iter0,&dc);
+    }
 
-  //get global bnorm
-  MPI_Allreduce(&localbnorm,&bnorm,1,MPI_DOUBLE,MPI_SUM,comm);
+  //some methods have their own data, such as the multigrid levels
 
-  bnorm=sqrt(bnorm);
+  if (sm->setup != NULL)
+    {
+      sm->setup(&dc);
+    }
 
-  //begin iterative Jacobi loop
+  //begin iterative loop
 
   if (rank == 0)
     {
@@ -173,56 +526,119 @@ int main(int argc, char **argv)
 
   tstart=MPI_Wtime();
 
-  for(iter=1;iter<=numiter;iter++)
+  //no error is known until the first reduction has been consumed, and
+  //none at all if the checkpoint is already at the last iteration
+
+  error   = 0.0;
+  erriter = iter0;
+  haveerr = 0;
+
+  for(iter=iter0+1;iter<=numiter;iter++)
     {
-      jacobistep(psitmp,psi,lm,n);
+      //the mixed smoother refines psi at the end of each call, so takes
+      //its refinement interval rather than the halo depth
 
-      //calculate current error if required
+      nstep = (sm->iterate == mixediterate) ? refine : depth;
+      if (nstep > numiter-iter+1) nstep = numiter-iter+1;
 
-      if (checkerr || iter == numiter)
-        {
-          localerror = deltasq(psitmp,psi,lm,n);
+      //nstep iterations of the smoother, which leaves the new values
+      //in psi, or one of the coupled psi and zeta equations
 
-          MPI_Allreduce(&localerror,&error,1,MPI_DOUBLE,MPI_SUM,comm);
-          error=sqrt(error);
-          error=error/bnorm;
+      if (irrotational)
+        {
+          localerror = sm->iterate(&psi,&psitmp,nstep,omega,&dc);
+        }
+      else
+        {
+          localerror = jacobivortiterate(&psi,&zet,&psitmp,&zettmp,re,&dc);
         }
 
-      //copy back
+      iter += nstep-1;
 
-      for(i=1;i<=lm;i++)
+      //the reduction started at the last check has had the whole of
+      //this iteration to complete, so waiting for it should be free
+
+      newerr = 0;
+
+      if (errreq != MPI_REQUEST_NULL)
         {
-          for(j=1;j<=n;j++)
-            {
-              psi[i][j]=psitmp[i][j];
-            }
+          timerstart(TIMERRESIDUAL);
+          MPI_Wait(&errreq,MPI_STATUS_IGNORE);
+          timerstop(TIMERRESIDUAL);
+          error=sqrt(errglobal);
+          error=error/bnorm;
+          newerr = 1;
+          haveerr = 1;
         }
 
-      //do a boundary swap
+      //the local error comes for free with the update; the final one is
+      //always needed, and is reduced straight away
 
-      haloswap(psi,lm,n,comm);
+      if (iter == numiter)
+        {
+          timerstart(TIMERRESIDUAL);
+          MPI_Allreduce(&localerror,&errglobal,1,MPI_DOUBLE,MPI_SUM,comm);
+          timerstop(TIMERRESIDUAL);
+          error=sqrt(errglobal);
+          error=error/bnorm;
+          erriter = iter;
+          newerr = 1;
+          haveerr = 1;
+        }
 
-      //quit early if we have reached required tolerance
+      //quit early if we have reached required tolerance; the solution
+      //is one iteration beyond the one the error was measured on
 
-      if (checkerr)
+      if (checkerr && newerr)
         {
           if (error < tolerance)
             {
               if (rank == 0)
                 {
-                  printf("Converged on iteration %d\n",iter);
+                  printf("Converged on iteration %d, error measured on iteration %d\n",
+                         iter,erriter);
                 }
               break;
             }
         }
 
+      //start the next check, to be completed on the following iteration
+
+      if (checkerr && iter < numiter &&
+          iter/checkfreq != (iter-nstep)/checkfreq)
+        {
+          errlocal = localerror;
+          timerstart(TIMERRESIDUAL);
+          MPI_Iallreduce(&errlocal,&errglobal,1,MPI_DOUBLE,MPI_SUM,comm,&errreq);
+          timerstop(TIMERRESIDUAL);
+          erriter = iter;
+        }
+
+      //save the state; this only copies the block, and if the last
+      //checkpoint has not been written yet on every process this one is
+      //skipped on all of them
+
+      if (chkfreq > 0 && iter < numiter &&
+          iter/chkfreq != (iter-nstep)/chkfreq)
+        {
+          timerstart(TIMERCOPY);
+
+          if (!checkpointwrite(&chk,psi,zet,iter,bnorm) && rank == 0)
+            {
+              printf("Skipped checkpoint at iteration %d, previous one still being written\n",
+                     iter);
+            }
+
+          timerstop(TIMERCOPY);
+        }
+
       //print loop information
 
-      if(iter%printfreq == 0)
+      if(iter/printfreq != (iter-nstep)/printfreq)
         {
           if (rank==0)
             {
-              if (!checkerr)
+              if (!checkerr || !haveerr)
                 {
                   printf("Completed iteration %d\n",iter);
                 }
@@ -240,21 +656,100 @@ int main(int argc, char **argv)
   tstop=MPI_Wtime();
 
   ttot=tstop-tstart;
-  titer=ttot/(double)iter;
 
+  //wait for the last checkpoint outside the timed loop
+
+  if (chkfreq > 0)
+    {
+      timerstart(TIMERIO);
+      checkpointfinish(&chk);
+      timerstop(TIMERIO);
+    }
+
+  //the error is the change over an iteration, which in float cannot go
+  //much below the rounding error; also check in double how well psi
+  //satisfies the equation
+
+  if (irrotational)
+    {
+      haloswap(psi,&dc);
+
+      localerror = residualsq(psi,lm,ln);
+      MPI_Allreduce(&localerror,&resid,1,MPI_DOUBLE,MPI_SUM,comm);
+
+      resid=sqrt(resid);
+      resid=resid/bnorm;
+    }
 
   //print out some stats
-  if (rank == 0)
+  if (rank == 0 && iter <= iter0)
+    {
+      printf("\nCheckpoint is already at iteration %d, nothing to do\n",iter0);
+    }
+  else if (rank == 0)
     {
+      niter=iter-iter0;
+      titer=ttot/(double)niter;
+
       printf("\n... finished\n");
       printf("After %d iterations, the error is %g\n",iter,error);
-      printf("Time for %d iterations was %g seconds\n",iter,ttot);
+      if (irrotational) printf("The residual, in double precision, is %g\n",resid);
+      printf("Time for %d iterations was %g seconds\n",niter,ttot);
       printf("Each iteration took %g seconds\n",titer);
     }
 
-  //free un-needed arrays
-  free(psi);
-  free(psitmp);
+  //output the flow; the halos are needed for the velocities
+
+  if (outfile != NULL)
+    {
+      //columns of interleaved arrays need the pair datatypes
+
+      if (irrotational)
+        {
+          haloswap(psi,&dc);
+        }
+      else
+        {
+          MPI_Request req[HALONREQ];
+
+          haloswappairbegin(psi,&dc,req);
+          haloswapend(req);
+        }
+
+      timerstart(TIMERIO);
+
+      writedatafiles(psi,scalefactor,outfile,&dc);
+
+      if (rank == 0)
+        {
+          writeplotfile(m,n,scalefactor);
+        }
+
+      timerstop(TIMERIO);
+    }
+
+  timerreport(comm);
+
+  if (tracefile != NULL)
+    {
+      timertrace(tracefile,comm);
+    }
+
+  //free un-needed arrays, and the halo requests that refer to them
+  halofree();
+
+  if (sm->finish != NULL)
+    {
+      sm->finish();
+    }
+
+  //this also frees zet and zettmp, which share the allocations of psi
+  //and psitmp
+
+  arrayfree2dhalo((void **) psi,depth);
+  arrayfree2dhalo((void **) psitmp,depth);
+
+  decompfree(&dc);
 
   MPI_Finalize();
 
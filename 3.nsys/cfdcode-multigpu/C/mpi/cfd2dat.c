@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfdbin.h"
+
+//convert the binary file written by cfd into the colourmap.dat and
+//velocity.dat text files read by the gnuplot script cfd.plt
+
+static int findfield(cfdbinheader *header, const char *name,
+		     const char *type, int ncomp)
+{
+  int k;
+
+  for (k=0; k < header->nfield && k < CFDBINNFIELD; k++)
+    {
+      if (strcmp(header->field[k].name, name) == 0 &&
+	  strcmp(header->field[k].type, type) == 0 &&
+	  header->field[k].ncomp == ncomp)
+	{
+	  return k;
+	}
+    }
+
+  return -1;
+}
+
+int main(int argc, char **argv)
+{
+  const char *filename = "cfd.bin";
+
+  cfdbinheader header;
+
+  FILE *rfile, *vfile, *cfile, *velfile;
+
+  unsigned char *rgb;
+  double *vel;
+
+  int m, n, scale, ix, iy, krgb, kvel;
+
+  if (argc > 2)
+    {
+      printf("Usage: cfd2dat [file]\n");
+      return 1;
+    }
+
+  if (argc == 2) filename = argv[1];
+
+  //the two fields are read a row at a time through separate streams
+
+  rfile = fopen(filename, "rb");
+  vfile = fopen(filename, "rb");
+
+  if (rfile == NULL || vfile == NULL)
+    {
+      printf("ERROR: cannot open %s\n", filename);
+      return 1;
+    }
+
+  if (fread(&header, sizeof(header), 1, rfile) != 1 ||
+      strcmp(header.magic, CFDBINMAGIC) != 0)
+    {
+      printf("ERROR: %s is not a cfd binary file\n", filename);
+      return 1;
+    }
+
+  krgb = findfield(&header, "rgb", "u1", 3);
+  kvel = findfield(&header, "vel", "f8", 2);
+
+  if (krgb < 0 || kvel < 0)
+    {
+      printf("ERROR: %s does not contain rgb and vel fields\n", filename);
+      return 1;
+    }
+
+  m     = header.m;
+  n     = header.n;
+  scale = header.scale;
+
+  printf("Converting %d x %d grid from %s ...\n", m, n, filename);
+
+  rgb = (unsigned char *) malloc(3*n*sizeof(unsigned char));
+  vel = (double *)        malloc(2*n*sizeof(double));
+
+  fseek(rfile, header.field[krgb].offset, SEEK_SET);
+  fseek(vfile, header.field[kvel].offset, SEEK_SET);
+
+  cfile   = fopen("colourmap.dat","w");
+  velfile = fopen("velocity.dat","w");
+
+  for (ix=1; ix <= m; ix++)
+    {
+      if (fread(rgb, 3*sizeof(unsigned char), n, rfile) != (size_t) n ||
+	  fread(vel, 2*sizeof(double), n, vfile) != (size_t) n)
+	{
+	  printf("ERROR: %s is truncated\n", filename);
+	  return 1;
+	}
+
+      for (iy=1; iy <= n; iy++)
+	{
+	  fprintf(cfile,"%i %i %i %i %i\n", ix, iy,
+		  rgb[3*(iy-1)], rgb[3*(iy-1)+1], rgb[3*(iy-1)+2]);
+
+	  if ((ix-1)%scale == (scale-1)/2 &&
+	      (iy-1)%scale == (scale-1)/2    )
+	    {
+	      fprintf(velfile,"%i %i %f %f\n",
+		      ix, iy, vel[2*(iy-1)], vel[2*(iy-1)+1]);
+	    }
+	}
+    }
+
+  fclose(velfile);
+  fclose(cfile);
+  fclose(vfile);
+  fclose(rfile);
+
+  free(rgb);
+  free(vel);
+
+  printf("... written colourmap.dat and velocity.dat\n");
+
+  return 0;
+}
@@ -0,0 +1,23 @@
+//layout of the binary output file written by writedatafiles(). A
+//header is followed by each field stored as a global m x n array in
+//C order (x index slowest), all in native byte order
+
+#define CFDBINMAGIC  "CFDBIN1"
+#define CFDBINNFIELD 2
+
+typedef struct
+{
+  char      name[8];         //field name, e.g. "rgb"
+  char      type[4];         //element type, "u1" or "f8" as in numpy
+  int       ncomp;           //number of components per grid point
+  long long offset;          //byte offset of the field in the file
+} cfdbinfield;
+
+typedef struct
+{
+  char        magic[8];      //CFDBINMAGIC
+  int         m, n;          //global grid size
+  int         scale;         //scale factor of the run
+  int         nfield;        //number of fields that follow
+  cfdbinfield field[CFDBINNFIELD];
+} cfdbinheader;
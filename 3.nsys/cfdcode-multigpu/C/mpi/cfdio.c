@@ -1,35 +1,54 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <float.h>
+#include <string.h>
+#include <stdint.h>
 
+#include "precision.h"
+#include "decomp.h"
 #include "cfdio.h"
+#include "cfdbin.h"
 #include "arraymalloc.h"
 
-void writedatafiles(double **psi, int m, int n, int scale, MPI_Comm comm)
+//write velocities and colours to a binary file with MPI-IO; every
+//process writes its own block collectively, described by a subarray
+//file view. cfd2dat turns the file into the text files for gnuplot
+
+void writedatafiles(Float_t **psi, int scale, const char *filename,
+		    const decomp *dc)
 {
-  typedef double Vecvel[2];
-  typedef int    Vecrgb[3];
+  typedef double        Vecvel[2];
+  typedef unsigned char Vecrgb[3];
 
   Vecvel **vel;
   Vecrgb **rgb;
 
-  double modvsq, hue;
-  int size, rank, irank, i,j, ix, iy;
-  int nvel, nrgb;
+  double *modvsq;
+  int rank, i, j;
+  int m, n;
+
+  int sizes[2], subsizes[2], starts[2];
 
-  int tag=1;
+  cfdbinheader header;
 
-  MPI_Status status;
+  MPI_Datatype veltype, rgbtype, velfile, rgbfile;
+  MPI_File fh;
+  MPI_Comm comm = dc->comm;
 
   MPI_Comm_rank(comm,&rank);
-  MPI_Comm_size(comm,&size);
 
-  if (rank==0) printf("\n\nWriting data files ...\n");
+  if (rank==0) printf("\n\nWriting data file %s ...\n", filename);
+
+  m = dc->lm;
+  n = dc->ln;
 
   vel = (Vecvel **) arraymalloc2d(m,n,sizeof(Vecvel));
   rgb = (Vecrgb **) arraymalloc2d(m,n,sizeof(Vecrgb));
 
-  //calculate velocities and hues
+  modvsq = (double *) malloc(n*sizeof(double));
+
+  //calculate velocities, then the colours a row at a time
 
   double v1, v2;
 
@@ -43,61 +62,84 @@ void writedatafiles(double **psi, int m, int n, int scale, MPI_Comm comm)
 	  v1 = vel[i][j][0];
 	  v2=  vel[i][j][1];
 
-	  modvsq = v1*v1 + v2*v2;
-
-	  hue = pow(modvsq,0.4);
-
-	  hue2rgb(hue,&(rgb[i][j][0]),&(rgb[i][j][1]),&(rgb[i][j][2]));
+	  modvsq[j] = v1*v1 + v2*v2;
 	}
+
+      hue2rgbrow(modvsq,&rgb[i][0][0],n);
     }
 
-  //receive ddata
+  free(modvsq);
+
+  //describe the file: the colours of the whole grid, then velocities
+
+  memset(&header, 0, sizeof(header));
+
+  strcpy(header.magic, CFDBINMAGIC);
+
+  header.m      = dc->m;
+  header.n      = dc->n;
+  header.scale  = scale;
+  header.nfield = CFDBINNFIELD;
+
+  strcpy(header.field[0].name, "rgb");
+  strcpy(header.field[0].type, "u1");
+  header.field[0].ncomp  = 3;
+  header.field[0].offset = sizeof(header);
+
+  strcpy(header.field[1].name, "vel");
+  strcpy(header.field[1].type, "f8");
+  header.field[1].ncomp  = 2;
+  header.field[1].offset = header.field[0].offset + (long long) dc->m*dc->n*sizeof(Vecrgb);
+
+  //one grid point of each field, and this block within the global
+  //array of grid points
+
+  MPI_Type_contiguous(3, MPI_UNSIGNED_CHAR, &rgbtype);
+  MPI_Type_contiguous(2, MPI_DOUBLE, &veltype);
+  MPI_Type_commit(&rgbtype);
+  MPI_Type_commit(&veltype);
+
+  sizes[0]    = dc->m;
+  sizes[1]    = dc->n;
+  subsizes[0] = m;
+  subsizes[1] = n;
+  starts[0]   = dc->istart-1;
+  starts[1]   = dc->jstart-1;
+
+  MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C,
+			   rgbtype, &rgbfile);
+  MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C,
+			   veltype, &velfile);
+  MPI_Type_commit(&rgbfile);
+  MPI_Type_commit(&velfile);
+
+  MPI_File_open(comm, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+		MPI_INFO_NULL, &fh);
+
+  //remove anything left from a larger file
+
+  MPI_File_set_size(fh, 0);
 
   if (rank == 0)
     {
-      FILE *cfile, *vfile;
+      MPI_File_write_at(fh, 0, &header, sizeof(header), MPI_BYTE,
+			MPI_STATUS_IGNORE);
+    }
 
-      cfile=fopen("colourmap.dat","w");
-      vfile=fopen("velocity.dat","w");
+  MPI_File_set_view(fh, header.field[0].offset, rgbtype, rgbfile,
+		    "native", MPI_INFO_NULL);
+  MPI_File_write_all(fh, &rgb[0][0][0], m*n, rgbtype, MPI_STATUS_IGNORE);
 
-      for (irank=0;irank<size;irank++)
-	{
-	  if (irank != 0)
-	    {
-	      MPI_Recv(&rgb[0][0][0],3*m*n,MPI_INT,irank,tag,comm,&status);
-	      MPI_Recv(&vel[0][0][0],2*m*n,MPI_DOUBLE,irank,tag,comm,&status);
-	    }
-
-	  for (i=0;i<m;i++)
-	      {
-		ix = irank*m+i+1;
-
-                for (j=0;j<n;j++)
-		  {
-		    iy = j+1;
-
-                    fprintf(cfile,"%i %i %i %i %i\n", ix, iy,
-			    rgb[i][j][0], rgb[i][j][1],rgb[i][j][2]);
-
-                    if ((ix-1)%scale == (scale-1)/2 &&
-			(iy-1)%scale == (scale-1)/2    )
-		      {
-
-                        fprintf(vfile,"%i %i %f %f\n",
-				ix,iy,vel[i][j][0],vel[i][j][1]);
-		      }
-		  }
-	      }
-	  }
-
-        fclose(vfile);
-        fclose(cfile);
-      }
-    else
-      {
-	MPI_Ssend(&rgb[0][0][0],3*m*n,MPI_INT,0,tag,comm);
-	MPI_Ssend(&vel[0][0][0],2*m*n,MPI_DOUBLE,0,tag,comm);
-      }
+  MPI_File_set_view(fh, header.field[1].offset, veltype, velfile,
+		    "native", MPI_INFO_NULL);
+  MPI_File_write_all(fh, &vel[0][0][0], m*n, veltype, MPI_STATUS_IGNORE);
+
+  MPI_File_close(&fh);
+
+  MPI_Type_free(&rgbfile);
+  MPI_Type_free(&velfile);
+  MPI_Type_free(&rgbtype);
+  MPI_Type_free(&veltype);
 
   free(rgb);
   free(vel);
@@ -159,3 +201,180 @@ double colfunc(double x)
       return 1.0-pow((absx-x1)/(x2-x1),2);
     }
 }
+
+
+//x^0.4 for normal x > 0, as 2^(0.4 log2 x). The exponent and mantissa
+//are taken apart with integer operations and the logarithm and power
+//of 2 are short series, so unlike pow() this vectorises. The relative
+//error is below 1e-13
+
+static inline double pow04(double x)
+{
+  const double magic = 6755399441055744.0;   // 1.5*2^52
+
+  uint64_t bits, mbits, ebits, kbits, big;
+  double e, mant, f, f2, lnmant, y, kmagic, k, r, p, twok;
+
+  memcpy(&bits, &x, sizeof(bits));
+
+  // mantissa in [1,2), moved to [sqrt(1/2),sqrt(2)) for the series by
+  // taking one off its exponent and adding it to that of x. The test
+  // against M_SQRT2 is on the bit patterns, which order as the values
+  // do: big is the sign bit of their difference. Written with a select
+  // the compiler turns it into a branch, and a 64 bit compare has no
+  // SSE2 or AVX2 instruction, either of which stops the loop in
+  // hue2rgbrow from vectorising
+
+  mbits = (bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+  big   = (0x3ff6a09e667f3bcdULL - mbits) >> 63;
+  mbits = mbits - (big << 52);
+  memcpy(&mant, &mbits, sizeof(mant));
+
+  // unbiased exponent, converted to double via its bit pattern
+
+  ebits = ((bits >> 52) + big) | 0x4330000000000000ULL;
+  memcpy(&e, &ebits, sizeof(e));
+  e = e - 4503599627370496.0 - 1023.0;
+
+  // ln(mant) = 2 atanh(f), |f| < 0.172
+
+  f  = (mant-1.0)/(mant+1.0);
+  f2 = f*f;
+
+  lnmant = 2.0*f*(1.0 + f2*(1.0/3.0 + f2*(1.0/5.0 + f2*(1.0/7.0 + f2*(1.0/9.0
+	   + f2*(1.0/11.0 + f2*(1.0/13.0 + f2*(1.0/15.0))))))));
+
+  y = 0.4*(e + lnmant/M_LN2);
+
+  // 2^y = 2^k e^r, with k the nearest integer to y and |r| < 0.35
+
+  kmagic = y + magic;
+  k = kmagic - magic;
+  r = (y - k)*M_LN2;
+
+  p = 1.0 + r*(1.0 + r*(1.0/2.0 + r*(1.0/6.0 + r*(1.0/24.0 + r*(1.0/120.0
+      + r*(1.0/720.0 + r*(1.0/5040.0 + r*(1.0/40320.0 + r*(1.0/362880.0
+      + r*(1.0/3628800.0 + r*(1.0/39916800.0 + r*(1.0/479001600.0))))))))))));
+
+  // 2^k from the low bits of y + magic, which hold k + 2^51; there is
+  // no vector conversion from double to a 64 bit integer before AVX-512
+
+  memcpy(&kbits, &kmagic, sizeof(kbits));
+  ebits = (kbits - 0x4338000000000000ULL + 1023) << 52;
+  memcpy(&twok, &ebits, sizeof(twok));
+
+  return p*twok;
+}
+
+//colfunc() without branches; the clamp to [0,1] reproduces its three
+//cases. It is done on the bit pattern, with shifts and masks, for the
+//same reasons as the test in pow04(): a negative t has the sign bit
+//set, and non-negative ones order as their bits do
+
+static inline double colfuncrow(double x)
+{
+  const uint64_t one = 0x3ff0000000000000ULL;   // 1.0
+
+  uint64_t tbits, mask;
+  double t;
+
+  double x1=0.2;
+  double x2=0.5;
+
+  t = (fabs(x)-x1)/(x2-x1);
+
+  memcpy(&tbits, &t, sizeof(tbits));
+
+  mask  = (tbits >> 63) - 1;             // 0 if t < 0, else all ones
+  tbits = tbits & mask;
+
+  mask  = 0 - ((one - tbits) >> 63);     // all ones if t > 1, else 0
+  tbits = (tbits & ~mask) | (one & mask);
+
+  memcpy(&t, &tbits, sizeof(t));
+
+  return 1.0-t*t;
+}
+
+//colours for a row of n points from their squared speed, as given by
+//hue2rgb(pow(modvsq,0.4),...) but written so the compiler can
+//vectorise the loop. rgb holds 3 bytes per point. Since the hue is
+//within 1e-13 relative of pow(), a channel can only differ from
+//hue2rgb by one, and only where 255*colfunc() is within about 1e-10
+//of an integer; the end points 0 and 255 are exact
+
+void hue2rgbrow(const double *modvsq, unsigned char *rgb, int n)
+{
+  int j;
+
+  int rgbmax = 255;
+
+  double hue;
+
+#pragma omp simd private(hue)
+  for (j=0; j<n; j++)
+    {
+      // no test for 0 or a subnormal: pow04 reads their exponent as
+      // -1023 and gives a hue below 1e-120, the same colours as 0. A
+      // branch here would keep the loop from vectorising, as its
+      // floating point operations could trap
+
+      hue = pow04(modvsq[j]);
+
+      rgb[3*j]   = (unsigned char) (int)(rgbmax*colfuncrow(hue-1.0));
+      rgb[3*j+1] = (unsigned char) (int)(rgbmax*colfuncrow(hue-0.5));
+      rgb[3*j+2] = (unsigned char) (int)(rgbmax*colfuncrow(hue    ));
+    }
+}
+
+//read the relative throughput of each of size processes from a text
+//file, one positive number per line in rank order; lines starting with
+//# are comments. Returns 0 on success
+
+int readweights(const char *filename, int size, double *weight)
+{
+  FILE *fp;
+  char line[256];
+  int nread = 0;
+
+  fp = fopen(filename, "r");
+
+  if (fp == NULL)
+    {
+      printf("ERROR: cannot open weights file %s\n", filename);
+      return 1;
+    }
+
+  while (nread < size && fgets(line, sizeof(line), fp) != NULL)
+    {
+      char *end;
+      double x;
+
+      if (line[strspn(line, " \t")] == '#') continue;
+
+      x = strtod(line, &end);
+
+      //skip blank lines
+      if (end == line) continue;
+
+      if (!(x > 0.0))
+	{
+	  printf("ERROR: weight %g for rank %d in %s is not positive\n", x, nread, filename);
+	  fclose(fp);
+	  return 1;
+	}
+
+      weight[nread++] = x;
+    }
+
+  fclose(fp);
+
+  if (nread < size)
+    {
+      printf("ERROR: weights file %s has %d weight(s) for %d process(es)\n",
+	     filename, nread, size);
+      return 1;
+    }
+
+  return 0;
+}
@@ -1,9 +1,14 @@
 #include <mpi.h>
 
-void writedatafiles(double **psi, int m, int n, int scale, MPI_Comm comm);
+void writedatafiles(Float_t **psi, int scale, const char *filename,
+		    const decomp *dc);
 
 void writeplotfile(int m, int n, int scale);
 
 void hue2rgb(double hue, int *r, int *g, int *b);
 
+void hue2rgbrow(const double *modvsq, unsigned char *rgb, int n);
+
 double colfunc(double x);
+
+int readweights(const char *filename, int size, double *weight);
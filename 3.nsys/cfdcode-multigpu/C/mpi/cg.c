@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+#include "arraymalloc.h"
+#include "precision.h"
+#include "decomp.h"
+#include "boundary.h"
+#include "jacobi.h"
+#include "cg.h"
+#include "timer.h"
+
+//pipelined CG, after Ghysels and Vanroose, Parallel Computing 40
+//(2014) 224. The operator is A x = 4x - sum of neighbours over the
+//interior, with the fixed boundary values of psi moved into the right
+//hand side. Standard CG needs two global reductions per iteration;
+//here the two dot products are reduced together, and the reduction is
+//overlapped with the preconditioner and the matrix-vector product,
+//each of which has a halo swap. The price is four extra vectors and
+//recurrences that are a little less stable in finite precision
+
+//working vectors, with halos that stay zero at the edges of the grid
+
+static Float_t **r, **u, **w, **m, **nv, **z, **q, **s, **p, **t;
+
+static int    nprecond = 0;  //Jacobi sweeps of the preconditioner
+static int    started  = 0;  //whether the residual has been set up
+static double gammaold, alphaold;
+static double dot[2];        //local (r,u) and (w,u) for the next step
+
+void cgprecondset(int nsweep)
+{
+  nprecond = nsweep;
+}
+
+//y = A x on istart..istop x jstart..jstop
+
+static void cgapplyblock(Float_t **y, Float_t **x,
+			 int istart, int istop, int jstart, int jstop)
+{
+  int i, j;
+
+  timerstart(TIMERSTENCIL);
+
+#pragma omp parallel for schedule(static) private(j) \
+  if((istop-istart+1)*(jstop-jstart+1) >= JACOBIOMPMIN)
+  for(i=istart;i<=istop;i++)
+    {
+      Float_t * restrict y0 = y[i];
+
+      const Float_t * restrict xm = x[i-1];
+      const Float_t * restrict x0 = x[i];
+      const Float_t * restrict xp = x[i+1];
+
+#pragma omp simd
+      for(j=jstart;j<=jstop;j++)
+	{
+	  y0[j] = 4.0f*x0[j] - (xm[j]+xp[j]+x0[j-1]+x0[j+1]);
+	}
+    }
+
+  timerstop(TIMERSTENCIL);
+}
+
+//y = A x, with the halo swap of x overlapped with the interior
+
+static void cgapply(Float_t **y, Float_t **x, const decomp *dc)
+{
+  MPI_Request req[HALONREQ];
+
+  int lm = dc->lm;
+  int ln = dc->ln;
+
+  haloswapbegin(x,dc,req);
+
+  cgapplyblock(y,x,2,lm-1,2,ln-1);
+
+  haloswapend(req);
+
+  cgapplyblock(y,x,1,1,1,ln);
+  if (lm > 1) cgapplyblock(y,x,lm,lm,1,ln);
+
+  cgapplyblock(y,x,2,lm-1,1,1);
+  if (ln > 1) cgapplyblock(y,x,2,lm-1,ln,ln);
+}
+
+//y = M^-1 x. nprecond steps of Jacobi on A y = x from y = 0, which is
+//a polynomial in A and so symmetric positive definite. One step is
+//just x/4, which does not change CG as the diagonal is constant
+
+static void cgprecond(Float_t **y, Float_t **x, const decomp *dc)
+{
+  int i, j, k;
+
+  int lm = dc->lm;
+  int ln = dc->ln;
+
+#pragma omp parallel for schedule(static) private(j) if(lm*ln >= JACOBIOMPMIN)
+  for (i=1; i<=lm; i++)
+    {
+      for (j=1; j<=ln; j++)
+	{
+	  y[i][j] = (nprecond > 0) ? 0.25f*x[i][j] : x[i][j];
+	}
+    }
+
+  for (k=1; k<nprecond; k++)
+    {
+      cgapply(t,y,dc);
+
+#pragma omp parallel for schedule(static) private(j) if(lm*ln >= JACOBIOMPMIN)
+      for (i=1; i<=lm; i++)
+	{
+	  for (j=1; j<=ln; j++)
+	    {
+	      y[i][j] += 0.25f*(x[i][j]-t[i][j]);
+	    }
+	}
+    }
+}
+
+//local (r,u) and (w,u)
+
+static void cgdots(const decomp *dc)
+{
+  int i, j;
+
+  double ru=0.0, wu=0.0;
+
+  int lm = dc->lm;
+  int ln = dc->ln;
+
+  timerstart(TIMERRESIDUAL);
+
+#pragma omp parallel for schedule(static) private(j) reduction(+:ru,wu) \
+  if(lm*ln >= JACOBIOMPMIN)
+  for (i=1; i<=lm; i++)
+    {
+      for (j=1; j<=ln; j++)
+	{
+	  ru += r[i][j]*u[i][j];
+	  wu += w[i][j]*u[i][j];
+	}
+    }
+
+  dot[0] = ru;
+  dot[1] = wu;
+
+  timerstop(TIMERRESIDUAL);
+}
+
+//r = b - A x, u = M^-1 r and w = A u from the current psi
+
+static void cgstart(Float_t **x, const decomp *dc)
+{
+  int i, j;
+
+  int lm = dc->lm;
+  int ln = dc->ln;
+
+  haloswap(x,dc);
+
+  timerstart(TIMERRESIDUAL);
+
+#pragma omp parallel for schedule(static) private(j) if(lm*ln >= JACOBIOMPMIN)
+  for (i=1; i<=lm; i++)
+    {
+      for (j=1; j<=ln; j++)
+	{
+	  r[i][j] = x[i-1][j]+x[i+1][j]+x[i][j-1]+x[i][j+1] - 4.0f*x[i][j];
+	}
+    }
+
+  timerstop(TIMERRESIDUAL);
+
+  cgprecond(u,r,dc);
+  cgapply(w,u,dc);
+
+  cgdots(dc);
+
+  started = 1;
+}
+
+void cgsetup(const decomp *dc)
+{
+  int lm = dc->lm;
+  int ln = dc->ln;
+
+  r  = (Float_t **) arraymalloc2dhalo(lm,ln,1,sizeof(Float_t),1);
+  u  = (Float_t **) arraymalloc2dhalo(lm,ln,1,sizeof(Float_t),1);
+  w  = (Float_t **) arraymalloc2dhalo(lm,ln,1,sizeof(Float_t),1);
+  m  = (Float_t **) arraymalloc2dhalo(lm,ln,1,sizeof(Float_t),1);
+  nv = (Float_t **) arraymalloc2dhalo(lm,ln,1,sizeof(Float_t),1);
+  z  = (Float_t **) arraymalloc2dhalo(lm,ln,1,sizeof(Float_t),1);
+  q  = (Float_t **) arraymalloc2dhalo(lm,ln,1,sizeof(Float_t),1);
+  s  = (Float_t **) arraymalloc2dhalo(lm,ln,1,sizeof(Float_t),1);
+  p  = (Float_t **) arraymalloc2dhalo(lm,ln,1,sizeof(Float_t),1);
+  t  = (Float_t **) arraymalloc2dhalo(lm,ln,1,sizeof(Float_t),1);
+
+  if (r == NULL || u == NULL || w == NULL || m == NULL || nv == NULL ||
+      z == NULL || q == NULL || s == NULL || p == NULL || t == NULL)
+    {
+      printf("ERROR: failed to allocate cg arrays\n");
+      MPI_Abort(dc->comm,1);
+    }
+
+  started = 0;
+}
+
+//smoother interface: nstep iterations on psi. Returns the squared
+//change of psi over the last one. psitmp and omega are not used
+
+double cgiterate(Float_t ***psi, Float_t ***psitmp, int nstep,
+		 double omega, const decomp *dc)
+{
+  MPI_Request req;
+
+  Float_t **x = *psi;
+
+  double glob[2];
+  double gamma, delta, alpha, beta;
+  double dsq=0.0, ru, wu;
+
+  int it, i, j;
+
+  int lm = dc->lm;
+  int ln = dc->ln;
+
+  if (!started)
+    {
+      cgstart(x,dc);
+
+      gammaold = 0.0;
+      alphaold = 0.0;
+    }
+
+  for (it=0; it<nstep; it++)
+    {
+      //the one reduction of the iteration runs while m = M^-1 w and
+      //n = A m are computed
+
+      MPI_Iallreduce(dot,glob,2,MPI_DOUBLE,MPI_SUM,dc->comm,&req);
+
+      cgprecond(m,w,dc);
+      cgapply(nv,m,dc);
+
+      timerstart(TIMERRESIDUAL);
+      MPI_Wait(&req,MPI_STATUS_IGNORE);
+      timerstop(TIMERRESIDUAL);
+
+      gamma = glob[0];
+      delta = glob[1];
+
+      //the residual is zero to machine precision, nothing left to do
+
+      if (gamma <= 0.0)
+	{
+	  dsq = 0.0;
+	  break;
+	}
+
+      if (gammaold == 0.0)
+	{
+	  beta  = 0.0;
+	  alpha = gamma/delta;
+	}
+      else
+	{
+	  beta  = gamma/gammaold;
+	  alpha = gamma/(delta - beta*gamma/alphaold);
+	}
+
+      gammaold = gamma;
+      alphaold = alpha;
+
+      //all the vector updates in one pass, with the local parts of the
+      //next dot products and of the change in psi
+
+      dsq = 0.0;
+      ru  = 0.0;
+      wu  = 0.0;
+
+      timerstart(TIMERRESIDUAL);
+
+#pragma omp parallel for schedule(static) private(j) reduction(+:dsq,ru,wu) \
+  if(lm*ln >= JACOBIOMPMIN)
+      for (i=1; i<=lm; i++)
+	{
+	  Float_t * restrict xi = x[i];
+	  Float_t * restrict ri = r[i];
+	  Float_t * restrict ui = u[i];
+	  Float_t * restrict wi = w[i];
+	  Float_t * restrict zi = z[i];
+	  Float_t * restrict qi = q[i];
+	  Float_t * restrict si = s[i];
+	  Float_t * restrict pi = p[i];
+
+	  const Float_t * restrict mi = m[i];
+	  const Float_t * restrict ni = nv[i];
+
+#pragma omp simd reduction(+:dsq,ru,wu)
+	  for (j=1; j<=ln; j++)
+	    {
+	      zi[j] = ni[j] + beta*zi[j];
+	      qi[j] = mi[j] + beta*qi[j];
+	      si[j] = wi[j] + beta*si[j];
+	      pi[j] = ui[j] + beta*pi[j];
+
+	      xi[j] += alpha*pi[j];
+	      ri[j] -= alpha*si[j];
+	      ui[j] -= alpha*qi[j];
+	      wi[j] -= alpha*zi[j];
+
+	      dsq += alpha*alpha*pi[j]*pi[j];
+	      ru  += ri[j]*ui[j];
+	      wu  += wi[j]*ui[j];
+	    }
+	}
+
+      timerstop(TIMERRESIDUAL);
+
+      dot[0] = ru;
+      dot[1] = wu;
+    }
+
+  return dsq;
+}
+
+void cgfinish(void)
+{
+  arrayfree2dhalo((void **) r,1);
+  arrayfree2dhalo((void **) u,1);
+  arrayfree2dhalo((void **) w,1);
+  arrayfree2dhalo((void **) m,1);
+  arrayfree2dhalo((void **) nv,1);
+  arrayfree2dhalo((void **) z,1);
+  arrayfree2dhalo((void **) q,1);
+  arrayfree2dhalo((void **) s,1);
+  arrayfree2dhalo((void **) p,1);
+  arrayfree2dhalo((void **) t,1);
+}
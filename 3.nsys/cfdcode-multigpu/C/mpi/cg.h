@@ -0,0 +1,11 @@
+//pipelined conjugate gradients for the 5-point operator of the psi
+//equation, optionally preconditioned with a few Jacobi sweeps
+
+void cgprecondset(int nsweep);
+
+void cgsetup(const decomp *dc);
+
+double cgiterate(Float_t ***psi, Float_t ***psitmp, int nstep,
+		 double omega, const decomp *dc);
+
+void cgfinish(void);
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <mpi.h>
+
+#include "precision.h"
+#include "decomp.h"
+#include "checkpoint.h"
+
+static void checkpointname(char *name, size_t len, const char *prefix,
+			   int rank, int slot)
+{
+  snprintf(name, len, "%s.%d.%d", prefix, rank, slot);
+}
+
+//write the buffered block to its slot; runs in the background thread
+//and so must not make any MPI calls
+
+static void checkpointfile(checkpoint *chk)
+{
+  char name[300];
+  FILE *fp;
+  size_t nbuf;
+  int ok;
+
+  nbuf = (size_t) chk->header.nfield*chk->header.lm*chk->header.ln;
+
+  checkpointname(name, sizeof(name), chk->prefix, chk->rank, chk->slot);
+
+  fp = fopen(name, "wb");
+
+  if (fp == NULL)
+    {
+      printf("WARNING: rank %d cannot open checkpoint file %s\n", chk->rank, name);
+      return;
+    }
+
+  //the trailing header is only written once the data are, and the file
+  //synced so that it is complete on disk before it counts as the latest
+
+  ok =  fwrite(&chk->header, sizeof(chkheader), 1, fp) == 1;
+  ok = ok && fwrite(chk->buf, sizeof(double), nbuf, fp) == nbuf;
+  ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+  ok = ok && fwrite(&chk->header, sizeof(chkheader), 1, fp) == 1;
+  ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+
+  if (fclose(fp) != 0) ok = 0;
+
+  if (!ok)
+    {
+      printf("WARNING: rank %d failed to write checkpoint file %s\n", chk->rank, name);
+    }
+}
+
+static void *checkpointthread(void *arg)
+{
+  checkpoint *chk = (checkpoint *) arg;
+
+  pthread_mutex_lock(&chk->lock);
+
+  for (;;)
+    {
+      while (!chk->busy && !chk->quit)
+	{
+	  pthread_cond_wait(&chk->cond, &chk->lock);
+	}
+
+      if (!chk->busy) break;
+
+      pthread_mutex_unlock(&chk->lock);
+
+      checkpointfile(chk);
+
+      pthread_mutex_lock(&chk->lock);
+
+      chk->busy = 0;
+    }
+
+  pthread_mutex_unlock(&chk->lock);
+
+  return NULL;
+}
+
+static int checkpointcheck(const char *name, int nfield, const decomp *dc,
+			   chkheader *head);
+
+//start the thread that writes checkpoints of this process's block.
+//iter0 is the iteration of the checkpoint the run restarted from, or 0,
+//and the slot that holds it is not written until a newer one is
+
+void checkpointstart(checkpoint *chk, const char *prefix, int nfield,
+		     int iter0, const decomp *dc)
+{
+  char name[300];
+  chkheader head;
+  int slot;
+
+  memset(chk, 0, sizeof(checkpoint));
+
+  snprintf(chk->prefix, sizeof(chk->prefix), "%s", prefix);
+
+  chk->comm = dc->comm;
+
+  MPI_Comm_rank(dc->comm, &chk->rank);
+
+  chk->slot = -1;
+
+  for (slot=0; iter0 > 0 && slot<CHKNSLOT; slot++)
+    {
+      checkpointname(name, sizeof(name), prefix, chk->rank, slot);
+
+      if (checkpointcheck(name, nfield, dc, &head) == iter0) chk->slot = slot;
+    }
+
+  strcpy(chk->header.magic, CHKMAGIC);
+
+  chk->header.m         = dc->m;
+  chk->header.n         = dc->n;
+  chk->header.dims[0]   = dc->dims[0];
+  chk->header.dims[1]   = dc->dims[1];
+  chk->header.coords[0] = dc->coords[0];
+  chk->header.coords[1] = dc->coords[1];
+  chk->header.lm        = dc->lm;
+  chk->header.ln        = dc->ln;
+  chk->header.nfield    = nfield;
+
+  chk->buf = (double *) malloc((size_t) nfield*dc->lm*dc->ln*sizeof(double));
+
+  if (chk->buf == NULL)
+    {
+      printf("ERROR: rank %d failed to allocate checkpoint buffer\n", chk->rank);
+      MPI_Abort(dc->comm, 1);
+    }
+
+  pthread_mutex_init(&chk->lock, NULL);
+  pthread_cond_init(&chk->cond, NULL);
+
+  if (pthread_create(&chk->thread, NULL, checkpointthread, chk) != 0)
+    {
+      printf("ERROR: rank %d failed to start checkpoint thread\n", chk->rank);
+      MPI_Abort(dc->comm, 1);
+    }
+}
+
+//hand a copy of the interior of psi, and of zet unless it is NULL, to
+//the background thread. Must be called by all processes. The copy is
+//all the caller waits for; if the previous checkpoint is still being
+//written on any process this one is skipped on all of them rather than
+//stalling, and 0 is returned
+
+int checkpointwrite(checkpoint *chk, Float_t **psi, Float_t **zet,
+		    int iter, double bnorm)
+{
+  int i, j, busy, anybusy;
+
+  int lm = chk->header.lm;
+  int ln = chk->header.ln;
+
+  pthread_mutex_lock(&chk->lock);
+  busy = chk->busy;
+  pthread_mutex_unlock(&chk->lock);
+
+  MPI_Allreduce(&busy, &anybusy, 1, MPI_INT, MPI_LOR, chk->comm);
+
+  if (anybusy) return 0;
+
+  //the thread is idle, so the buffer and header are ours. Files are
+  //always in double, so that they do not depend on the precision of
+  //the build
+
+  for (i=0; i<lm; i++)
+    {
+      for (j=0; j<ln; j++)
+	{
+	  chk->buf[(size_t) i*ln+j] = psi[i+1][j+1];
+	}
+    }
+
+  if (chk->header.nfield == 2)
+    {
+      for (i=0; i<lm; i++)
+	{
+	  for (j=0; j<ln; j++)
+	    {
+	      chk->buf[(size_t) (lm+i)*ln+j] = zet[i+1][j+1];
+	    }
+	}
+    }
+
+  chk->header.iter  = iter;
+  chk->header.bnorm = bnorm;
+
+  //the next slot round from the latest checkpoint, which is kept until
+  //this one is complete
+
+  pthread_mutex_lock(&chk->lock);
+  chk->slot = (chk->slot+1)%CHKNSLOT;
+  chk->busy = 1;
+  pthread_cond_signal(&chk->cond);
+  pthread_mutex_unlock(&chk->lock);
+
+  return 1;
+}
+
+//wait for any checkpoint in progress and stop the thread
+
+void checkpointfinish(checkpoint *chk)
+{
+  pthread_mutex_lock(&chk->lock);
+  chk->quit = 1;
+  pthread_cond_signal(&chk->cond);
+  pthread_mutex_unlock(&chk->lock);
+
+  pthread_join(chk->thread, NULL);
+
+  pthread_mutex_destroy(&chk->lock);
+  pthread_cond_destroy(&chk->cond);
+
+  free(chk->buf);
+}
+
+//iteration of a complete checkpoint in file name that matches this
+//block, or -1
+
+static int checkpointcheck(const char *name, int nfield, const decomp *dc,
+			   chkheader *head)
+{
+  FILE *fp;
+  chkheader tail;
+  int ok;
+
+  fp = fopen(name, "rb");
+
+  if (fp == NULL) return -1;
+
+  ok =  fread(head, sizeof(chkheader), 1, fp) == 1;
+
+  ok = ok && strncmp(head->magic, CHKMAGIC, sizeof(head->magic)) == 0;
+  ok = ok && head->m == dc->m && head->n == dc->n;
+  ok = ok && head->dims[0] == dc->dims[0] && head->dims[1] == dc->dims[1];
+  ok = ok && head->coords[0] == dc->coords[0] && head->coords[1] == dc->coords[1];
+  ok = ok && head->lm == dc->lm && head->ln == dc->ln;
+  ok = ok && head->nfield == nfield;
+
+  ok = ok && fseek(fp, sizeof(chkheader) + (long) nfield*dc->lm*dc->ln*sizeof(double),
+		   SEEK_SET) == 0;
+  ok = ok && fread(&tail, sizeof(chkheader), 1, fp) == 1;
+  ok = ok && memcmp(head, &tail, sizeof(chkheader)) == 0;
+
+  fclose(fp);
+
+  return ok ? head->iter : -1;
+}
+
+//read the latest checkpoint that is complete on every process into the
+//interior of psi, and of zet unless it is NULL. Must be called by all
+//processes of the decomposition, which must be the same as when the
+//checkpoint was written. Returns 0, leaving the arrays alone, if there
+//is no such checkpoint
+
+int checkpointread(const char *prefix, Float_t **psi, Float_t **zet,
+		   int *iter, double *bnorm, const decomp *dc)
+{
+  char name[300];
+  chkheader head[CHKNSLOT];
+  FILE *fp;
+  double *row;
+  int rank, slot, use, i, j, ok;
+  int valid[CHKNSLOT];
+  int mine, limit, cand, have, allhave;
+
+  int nfield = (zet == NULL) ? 1 : 2;
+
+  MPI_Comm_rank(dc->comm, &rank);
+
+  for (slot=0; slot<CHKNSLOT; slot++)
+    {
+      checkpointname(name, sizeof(name), prefix, rank, slot);
+      valid[slot] = checkpointcheck(name, nfield, dc, &head[slot]);
+    }
+
+  //a write may have failed on some processes only, so
+  //look for the latest iteration that every process has, newest first
+
+  limit = INT_MAX;
+  use   = -1;
+
+  for (;;)
+    {
+      mine = -1;
+
+      for (slot=0; slot<CHKNSLOT; slot++)
+	{
+	  if (valid[slot] <= limit && valid[slot] > mine) mine = valid[slot];
+	}
+
+      MPI_Allreduce(&mine, &cand, 1, MPI_INT, MPI_MIN, dc->comm);
+
+      if (cand < 0) return 0;
+
+      have = 0;
+
+      for (slot=0; slot<CHKNSLOT; slot++)
+	{
+	  if (valid[slot] == cand)
+	    {
+	      have = 1;
+	      use  = slot;
+	    }
+	}
+
+      MPI_Allreduce(&have, &allhave, 1, MPI_INT, MPI_LAND, dc->comm);
+
+      if (allhave) break;
+
+      limit = cand-1;
+    }
+
+  checkpointname(name, sizeof(name), prefix, rank, use);
+
+  ok = 0;
+
+  row = (double *) malloc(dc->ln*sizeof(double));
+
+  fp = fopen(name, "rb");
+
+  if (fp != NULL)
+    {
+      ok = fseek(fp, sizeof(chkheader), SEEK_SET) == 0;
+
+      for (i=1; ok && i<=nfield*dc->lm; i++)
+	{
+	  ok = fread(row, sizeof(double), dc->ln, fp) == (size_t) dc->ln;
+
+	  for (j=1; ok && j<=dc->ln; j++)
+	    {
+	      if (i <= dc->lm) psi[i][j]        = row[j-1];
+	      else             zet[i-dc->lm][j] = row[j-1];
+	    }
+	}
+
+      fclose(fp);
+    }
+
+  free(row);
+
+  if (!ok)
+    {
+      printf("ERROR: rank %d failed to read checkpoint file %s\n", rank, name);
+      MPI_Abort(dc->comm, 1);
+    }
+
+  *iter  = head[use].iter;
+  *bnorm = head[use].bnorm;
+
+  return 1;
+}
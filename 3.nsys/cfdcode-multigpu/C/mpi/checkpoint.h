@@ -0,0 +1,53 @@
+#include <pthread.h>
+
+//per-process checkpoints of the psi block. Each process alternates
+//between two files, <prefix>.<rank>.0 and <prefix>.<rank>.1, so that
+//the previous checkpoint survives if the job dies during a write. A
+//file holds a header, the lm x ln interior of the block of each field
+//(psi, then zeta if the flow is not irrotational), in double whatever
+//the precision of the build, and then the header
+//again; it is complete only if the two headers agree. All processes
+//write or skip a checkpoint together, so the files of a slot hold the
+//same iteration on every process
+
+#define CHKMAGIC "CFDCHK2"
+#define CHKNSLOT 2
+
+typedef struct
+{
+  char   magic[8];           //CHKMAGIC
+  int    m, n;               //global grid size
+  int    dims[2], coords[2]; //process grid and position of this block
+  int    lm, ln;             //size of this block
+  int    nfield;             //1 for psi only, 2 for psi and zeta
+  int    iter;               //iterations completed
+  double bnorm;              //normalisation of the error
+} chkheader;
+
+//state shared with the background thread that writes the files
+
+typedef struct
+{
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  int             busy;      //a checkpoint is waiting or being written
+  int             quit;      //tell the thread to finish
+  int             slot;      //slot of the latest checkpoint, or -1
+  char            prefix[256];
+  int             rank;
+  MPI_Comm        comm;
+  chkheader       header;
+  double          *buf;      //copy of the block being written
+} checkpoint;
+
+void checkpointstart(checkpoint *chk, const char *prefix, int nfield,
+		     int iter0, const decomp *dc);
+
+int checkpointwrite(checkpoint *chk, Float_t **psi, Float_t **zet,
+		    int iter, double bnorm);
+
+void checkpointfinish(checkpoint *chk);
+
+int checkpointread(const char *prefix, Float_t **psi, Float_t **zet,
+		   int *iter, double *bnorm, const decomp *dc);
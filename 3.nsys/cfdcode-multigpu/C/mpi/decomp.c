@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <mpi.h>
+
+#include "arraymalloc.h"
+#include "precision.h"
+#include "decomp.h"
+
+//split n points over p processes as evenly as possible, the first
+//n%p processes getting one extra point. Returns size and 1-based start
+
+void decompblock(int n, int p, int coord, int *ln, int *nstart)
+{
+  int base, rem;
+
+  base = n/p;
+  rem  = n%p;
+
+  *ln     = base + (coord < rem ? 1 : 0);
+  *nstart = coord*base + (coord < rem ? coord : rem) + 1;
+}
+
+//as decompblock, but with block sizes in proportion to the weights w
+//of the p processes, rounded so that the blocks still cover n exactly
+
+void decompblockweighted(int n, int p, int coord, const double *w,
+			 int *ln, int *nstart)
+{
+  int k, start, stop;
+  double wsum, wbefore;
+
+  wsum    = 0.0;
+  wbefore = 0.0;
+
+  for (k=0; k<p; k++)
+    {
+      if (k < coord) wbefore += w[k];
+      wsum += w[k];
+    }
+
+  start = (int) floor(n*(wbefore/wsum) + 0.5);
+  stop  = (int) floor(n*((wbefore+w[coord])/wsum) + 0.5);
+
+  if (coord == p-1) stop = n;
+
+  *ln     = stop-start;
+  *nstart = start+1;
+}
+
+//choose the process grid that minimises the halo length of a block,
+//i.e. lm + ln, since the grid is usually far from square. Blocks must
+//be at least as big as the halo
+
+static void choosedims(int m, int n, int hw, int size, int *dims)
+{
+  int px, py, cost, mincost;
+
+  mincost = -1;
+
+  for (px=1; px <= size; px++)
+    {
+      if (size%px != 0) continue;
+
+      py = size/px;
+
+      //do not create blocks smaller than the halo
+
+      if (m/px < hw || n/py < hw) continue;
+
+      cost = (m+px-1)/px + (n+py-1)/py;
+
+      if (mincost < 0 || cost < mincost)
+	{
+	  mincost = cost;
+	  dims[0] = px;
+	  dims[1] = py;
+	}
+    }
+
+  //fall back to the MPI choice if nothing fitted
+
+  if (mincost < 0)
+    {
+      dims[0] = dims[1] = 0;
+      MPI_Dims_create(size, 2, dims);
+    }
+}
+
+//halo datatypes for the local block of dc
+
+static void decomptypes(decomp *dc)
+{
+  int stride;
+  int hw = dc->hw;
+
+  //rows of the arrays are padded, see arraymalloc2dhalo
+
+  stride = arraypad2d(dc->ln+2*hw, sizeof(Float_t));
+
+  //hw columns of lm points, and hw rows of ln points plus the halos
+  //at either end so that the corners are passed on. Deep halo columns
+  //also cover rows 0 and lm+1, as the stencil then reads the fixed
+  //boundary values there that belong to the next block in y
+
+  MPI_Type_vector(hw == 1 ? dc->lm : dc->lm+2, hw, stride,
+		  MPI_FLOAT_T, &dc->coltype);
+  MPI_Type_commit(&dc->coltype);
+
+  MPI_Type_vector(hw, dc->ln+2*hw, stride, MPI_FLOAT_T, &dc->rowtype);
+  MPI_Type_commit(&dc->rowtype);
+
+  //two arrays with interleaved rows are swapped together: a column
+  //alternates between them, and a row of one is followed by the same
+  //row of the other
+
+  dc->paircoltype = MPI_DATATYPE_NULL;
+  dc->pairrowtype = MPI_DATATYPE_NULL;
+
+  if (hw == 1)
+    {
+      MPI_Type_vector(2*dc->lm, 1, stride, MPI_FLOAT_T, &dc->paircoltype);
+      MPI_Type_commit(&dc->paircoltype);
+
+      MPI_Type_vector(2, dc->ln, stride, MPI_FLOAT_T, &dc->pairrowtype);
+      MPI_Type_commit(&dc->pairrowtype);
+    }
+}
+
+void decompcreate(decomp *dc, int m, int n, int hw, MPI_Comm comm)
+{
+  decompcreateweighted(dc, m, n, hw, 1.0, comm);
+}
+
+//as decompcreate, but blocks are sized in proportion to the weight of
+//each process, e.g. its measured throughput. A column of the process
+//grid gets the total weight of its processes, and so does a row; with
+//the usual 1D process grids that is exactly the weight of each block
+
+void decompcreateweighted(decomp *dc, int m, int n, int hw, double weight,
+			  MPI_Comm comm)
+{
+  int size, r, uniform;
+  int periods[2] = {0, 0};
+
+  int *coords;
+  double *w, *wx, *wy;
+
+  MPI_Comm_size(comm,&size);
+
+  dc->m = m;
+  dc->n = n;
+  dc->hw = hw;
+
+  choosedims(m, n, hw, size, dc->dims);
+
+  MPI_Cart_create(comm, 2, dc->dims, periods, 1, &dc->comm);
+  MPI_Cart_get(dc->comm, 2, dc->dims, periods, dc->coords);
+
+  MPI_Cart_shift(dc->comm, 0, 1, &dc->left, &dc->right);
+  MPI_Cart_shift(dc->comm, 1, 1, &dc->down, &dc->up);
+
+  //weights and positions of all processes in the new communicator,
+  //which may have been reordered
+
+  w      = (double *) malloc(size*sizeof(double));
+  coords = (int *)    malloc(2*size*sizeof(int));
+  wx     = (double *) calloc(dc->dims[0], sizeof(double));
+  wy     = (double *) calloc(dc->dims[1], sizeof(double));
+
+  MPI_Allgather(&weight, 1, MPI_DOUBLE, w, 1, MPI_DOUBLE, dc->comm);
+  MPI_Allgather(dc->coords, 2, MPI_INT, coords, 2, MPI_INT, dc->comm);
+
+  uniform = 1;
+
+  for (r=0; r<size; r++)
+    {
+      wx[coords[2*r]]   += w[r];
+      wy[coords[2*r+1]] += w[r];
+
+      if (w[r] != w[0]) uniform = 0;
+    }
+
+  //equal weights give the same blocks as always
+
+  if (uniform)
+    {
+      decompblock(m, dc->dims[0], dc->coords[0], &dc->lm, &dc->istart);
+      decompblock(n, dc->dims[1], dc->coords[1], &dc->ln, &dc->jstart);
+    }
+  else
+    {
+      decompblockweighted(m, dc->dims[0], dc->coords[0], wx, &dc->lm, &dc->istart);
+      decompblockweighted(n, dc->dims[1], dc->coords[1], wy, &dc->ln, &dc->jstart);
+    }
+
+  free(w);
+  free(coords);
+  free(wx);
+  free(wy);
+
+  decomptypes(dc);
+}
+
+//the grid with every 2 x 2 points of dc combined into one, on the same
+//process grid; m and n must be even. Coarse point I covers fine points
+//2I-1 and 2I and belongs to the process that has fine point 2I-1, so a
+//coarse block needs at most one fine point past the end of its fine
+//block in each direction, which is in the halo. Blocks of any size can
+//be coarsened, but one that has a single point in some direction may
+//come out empty. The halo width is 1
+
+void decompcoarsen(decomp *dcc, const decomp *dc)
+{
+  *dcc = *dc;
+
+  MPI_Comm_dup(dc->comm, &dcc->comm);
+
+  dcc->m  = dc->m/2;
+  dcc->n  = dc->n/2;
+  dcc->hw = 1;
+
+  dcc->istart = dc->istart/2 + 1;
+  dcc->jstart = dc->jstart/2 + 1;
+
+  dcc->lm = (dc->istart+dc->lm)/2 - dcc->istart + 1;
+  dcc->ln = (dc->jstart+dc->ln)/2 - dcc->jstart + 1;
+
+  decomptypes(dcc);
+}
+
+void decompfree(decomp *dc)
+{
+  MPI_Type_free(&dc->coltype);
+  MPI_Type_free(&dc->rowtype);
+
+  if (dc->paircoltype != MPI_DATATYPE_NULL)
+    {
+      MPI_Type_free(&dc->paircoltype);
+      MPI_Type_free(&dc->pairrowtype);
+    }
+  MPI_Comm_free(&dc->comm);
+}
@@ -0,0 +1,36 @@
+#include <mpi.h>
+
+//local block of a 2D cartesian decomposition of the m x n grid. The
+//first index (x) is split over dims[0] processes and the second (y)
+//over dims[1]; block sizes need not be equal. Local arrays have halos
+//hw points deep, as allocated by arraymalloc2dhalo
+
+typedef struct
+{
+  MPI_Comm comm;             //cartesian communicator
+  int dims[2], coords[2];    //process grid and position of this rank
+  int m, n;                  //global grid size
+  int lm, ln;                //local block size
+  int istart, jstart;        //global index of local point [1][1]
+  int hw;                    //halo width
+  int left, right;           //neighbours in x, MPI_PROC_NULL at edges
+  int down, up;              //neighbours in y, MPI_PROC_NULL at edges
+  MPI_Datatype coltype;      //hw columns of the block, see decompcreate
+  MPI_Datatype rowtype;      //hw rows of the block including the halos
+  MPI_Datatype paircoltype;  //column of two arrays from arraymalloc2dpair
+  MPI_Datatype pairrowtype;  //row of the same, both only if hw is 1
+} decomp;
+
+void decompcreate(decomp *dc, int m, int n, int hw, MPI_Comm comm);
+
+void decompcreateweighted(decomp *dc, int m, int n, int hw, double weight,
+			  MPI_Comm comm);
+
+void decompcoarsen(decomp *dcc, const decomp *dc);
+
+void decompfree(decomp *dc);
+
+void decompblock(int n, int p, int coord, int *ln, int *nstart);
+
+void decompblockweighted(int n, int p, int coord, const double *w,
+			 int *ln, int *nstart);
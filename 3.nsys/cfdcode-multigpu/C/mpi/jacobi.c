@@ -1,27 +1,418 @@
 #include <stdio.h>
+#include <mpi.h>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "precision.h"
+#include "decomp.h"
+#include "boundary.h"
 #include "jacobi.h"
+#include "timer.h"
+
+void jacobistep(Float_t **psinew, Float_t **psi, int m, int n)
+{
+  jacobistepblock(psinew, psi, 1, m, 1, n);
+}
+
+//update points istart..istop x jstart..jstop only, so that the halo
+//swap can overlap with the interior of the block. The squared change
+//is accumulated in the same sweep and returned, which saves a separate
+//pass of deltasq() over both arrays
 
-void jacobistep(double **psinew, double **psi, int m, int n)
+double jacobistepblock(Float_t **psinew, Float_t **psi,
+		       int istart, int istop, int jstart, int jstop)
 {
   int i, j;
 
-  for(i=1;i<=m;i++)
+  double dsq=0.0;
+  Float_t new, tmp;
+
+  timerstart(TIMERSTENCIL);
+
+  //rows are shared out between threads; small pieces such as the edges
+  //of the block are not worth starting a parallel region for
+
+#pragma omp parallel for schedule(static) private(j,new,tmp) reduction(+:dsq) \
+  if((istop-istart+1)*(jstop-jstart+1) >= JACOBIOMPMIN)
+  for(i=istart;i<=istop;i++)
     {
-      for(j=1;j<=n;j++)
+      //take the row pointers out of the inner loop so that it is a
+      //plain unit-stride loop the compiler can vectorise
+
+      Float_t * restrict pnew = psinew[i];
+
+      const Float_t * restrict pm = psi[i-1];
+      const Float_t * restrict p0 = psi[i];
+      const Float_t * restrict pp = psi[i+1];
+
+#pragma omp simd reduction(+:dsq) private(new,tmp)
+      for(j=jstart;j<=jstop;j++)
 	{
-	  psinew[i][j]=0.25*(psi[i-1][j]+psi[i+1][j]+psi[i][j-1]+psi[i][j+1]);
+	  new=0.25f*(pm[j]+pp[j]+p0[j-1]+p0[j+1]);
+
+	  tmp = new-p0[j];
+	  dsq += tmp*tmp;
+
+	  pnew[j]=new;
         }
     }
+
+  timerstop(TIMERSTENCIL);
+
+  return dsq;
+}
+
+//update the outermost rows and columns of the block, which are the
+//only points that depend on the halos
+
+double jacobistepedges(Float_t **psinew, Float_t **psi, int m, int n)
+{
+  double dsq;
+
+  dsq = jacobistepblock(psinew, psi, 1, 1, 1, n);
+  if (m > 1) dsq += jacobistepblock(psinew, psi, m, m, 1, n);
+
+  dsq += jacobistepblock(psinew, psi, 2, m-1, 1, 1);
+  if (n > 1) dsq += jacobistepblock(psinew, psi, 2, m-1, n, n);
+
+  return dsq;
+}
+
+//update one row from jlo to jhi, also returning the squared change
+//if delta is set
+
+static double waverow(Float_t * restrict pnew, const Float_t * restrict pm,
+		      const Float_t * restrict p0, const Float_t * restrict pp,
+		      int jlo, int jhi, int delta)
+{
+  int j;
+
+  double dsq=0.0;
+  Float_t new, tmp;
+
+  if (delta)
+    {
+#pragma omp simd reduction(+:dsq) private(new,tmp)
+      for(j=jlo;j<=jhi;j++)
+	{
+	  new=0.25f*(pm[j]+pp[j]+p0[j-1]+p0[j+1]);
+
+	  tmp = new-p0[j];
+	  dsq += tmp*tmp;
+
+	  pnew[j]=new;
+	}
+    }
+  else
+    {
+#pragma omp simd
+      for(j=jlo;j<=jhi;j++)
+	{
+	  pnew[j]=0.25f*(pm[j]+pp[j]+p0[j-1]+p0[j+1]);
+	}
+    }
+
+  return dsq;
+}
+
+//advance nstep <= hw iterations with a single halo swap of depth hw.
+//Step s also updates the nstep-s outer layers of the halo, except at
+//the edges of the grid where the halo holds the fixed boundary.
+//
+//The rows are cut into one block per thread and each thread first
+//sweeps the trapezoid of its block that needs no rows of the next
+//block: step s covers the block less s-1 rows at each inner end. Rows
+//are swept as a wavefront, step s working s-1 rows behind step 1, so
+//all nstep time levels of a row are computed while it is in cache.
+//Then the triangles left between neighbouring blocks, 2(s-1) rows at
+//step s, are filled in step by step. Blocks are at least 2 nstep rows
+//so that the triangles do not overlap.
+//
+//Two arrays are enough, since when step s overwrites a row of step
+//s-2 the last reader of that row, step s-1, has already passed it.
+//The result is in psinew if nstep is odd and in psi if it is even.
+//Returns the squared change of the last step
+
+double jacobistepwave(Float_t **psinew, Float_t **psi, int nstep,
+		      const decomp *dc)
+{
+  int r, s, i, j, b, nb, lo, hi, ext, jlo, jhi;
+
+  int m  = dc->lm;
+  int n  = dc->ln;
+  int hw = dc->hw;
+
+  //1 where the halo comes from a neighbour and can be updated
+
+  int xlo = (dc->left  != MPI_PROC_NULL);
+  int xhi = (dc->right != MPI_PROC_NULL);
+  int ylo = (dc->down  != MPI_PROC_NULL);
+  int yhi = (dc->up    != MPI_PROC_NULL);
+
+  //rows of step 1, which the blocks share out
+
+  int rlo = 1-(nstep-1)*xlo;
+  int rhi = m+(nstep-1)*xhi;
+
+  Float_t **arr[2];
+  double dsq=0.0;
+
+  timerstart(TIMERSTENCIL);
+
+  arr[0]=psi;
+  arr[1]=psinew;
+
+  //fixed boundary values that lie in a neighbour's halo arrive with
+  //the halo swap of psi only, so copy them over to psinew
+
+  for(i=1-hw;i<=m+hw;i++)
+    {
+      if (!ylo) psinew[i][0]   = psi[i][0];
+      if (!yhi) psinew[i][n+1] = psi[i][n+1];
+    }
+
+  for(j=1-hw;j<=n+hw;j++)
+    {
+      if (!xlo) psinew[0][j]   = psi[0][j];
+      if (!xhi) psinew[m+1][j] = psi[m+1][j];
+    }
+
+#pragma omp parallel private(r,s,i,b,nb,lo,hi,ext,jlo,jhi) reduction(+:dsq) \
+  if(m*n >= JACOBIOMPMIN)
+  {
+    nb = 1;
+
+#ifdef _OPENMP
+    nb = omp_get_num_threads();
+#endif
+
+    if (nb > (rhi-rlo+1)/(2*nstep)) nb = (rhi-rlo+1)/(2*nstep);
+    if (nb < 1) nb = 1;
+
+    //trapezoids, each block on its own
+
+#pragma omp for schedule(static)
+    for(b=0;b<nb;b++)
+      {
+	lo = rlo + ((rhi-rlo+1)*b)/nb;
+	hi = rlo + ((rhi-rlo+1)*(b+1))/nb - 1;
+
+	for(r=lo;r<=hi+nstep-1;r++)
+	  {
+	    for(s=1;s<=nstep;s++)
+	      {
+		ext = nstep-s;
+
+		i = r-(s-1);
+
+		//the ends of the grid shrink with the halo, the ends
+		//shared with another block shrink by one row a step
+
+		if (i < lo + (s-1)*(b > 0    ? 1 : xlo)) continue;
+		if (i > hi - (s-1)*(b < nb-1 ? 1 : xhi)) continue;
+
+		jlo = 1-ext*ylo;
+		jhi = n+ext*yhi;
+
+		dsq += waverow(arr[s%2][i], arr[(s-1)%2][i-1], arr[(s-1)%2][i],
+			       arr[(s-1)%2][i+1], jlo, jhi, s == nstep);
+	      }
+	  }
+      }
+
+    //triangles between the blocks, which never reach the ends of the
+    //grid so have no halo layers of their own
+
+#pragma omp for schedule(static)
+    for(b=0;b<nb-1;b++)
+      {
+	hi = rlo + ((rhi-rlo+1)*(b+1))/nb - 1;
+
+	for(s=2;s<=nstep;s++)
+	  {
+	    ext = nstep-s;
+
+	    jlo = 1-ext*ylo;
+	    jhi = n+ext*yhi;
+
+	    for(i=hi-s+2;i<=hi+s-1;i++)
+	      {
+		dsq += waverow(arr[s%2][i], arr[(s-1)%2][i-1], arr[(s-1)%2][i],
+			       arr[(s-1)%2][i+1], jlo, jhi, s == nstep);
+	      }
+	  }
+      }
+  }
+
+  timerstop(TIMERSTENCIL);
+
+  return dsq;
+}
+
+//advance nstep iterations, no more than the halo depth, leaving the
+//result in *psi; *psitmp must hold the boundary values too. Returns
+//the squared change of the last iteration. omega is not used
+
+double jacobiiterate(Float_t ***psi, Float_t ***psitmp, int nstep,
+		     double omega, const decomp *dc)
+{
+  MPI_Request req[HALONREQ];
+  Float_t **tmp;
+  double dsq;
+
+  int m = dc->lm;
+  int n = dc->ln;
+
+  if (nstep == 1)
+    {
+      //start the boundary swap and update the points that do not
+      //need the halos while it is in progress
+
+      haloswapbegin(*psi,dc,req);
+
+      dsq = jacobistepblock(*psitmp,*psi,2,m-1,2,n-1);
+
+      haloswapend(req);
+
+      //now update the edges of the block
+
+      dsq += jacobistepedges(*psitmp,*psi,m,n);
+    }
+  else
+    {
+      //one deep halo swap, then nstep iterations in a single sweep
+
+      haloswap(*psi,dc);
+
+      dsq = jacobistepwave(*psitmp,*psi,nstep,dc);
+    }
+
+  //swap the arrays instead of copying back; an even number of steps
+  //has left the result in psi already
+
+  if (nstep%2 == 1)
+    {
+      tmp=*psi;
+      *psi=*psitmp;
+      *psitmp=tmp;
+    }
+
+  return dsq;
 }
 
-double deltasq(double **newarr, double **oldarr, int m, int n)
+//one step of the coupled streamfunction-vorticity equations on
+//istart..istop x jstart..jstop, both fields in the same sweep.
+//Returns the squared change of both
+
+double jacobistepvort(Float_t **zetnew, Float_t **psinew,
+		      Float_t **zet,    Float_t **psi,
+		      int istart, int istop, int jstart, int jstop,
+		      double re)
+{
+  int i, j;
+
+  double dsq=0.0;
+  Float_t pnew, znew, tmp;
+
+  Float_t r16 = re/16.0;
+
+  timerstart(TIMERSTENCIL);
+
+#pragma omp parallel for schedule(static) private(j,pnew,znew,tmp) reduction(+:dsq) \
+  if((istop-istart+1)*(jstop-jstart+1) >= JACOBIOMPMIN)
+  for(i=istart;i<=istop;i++)
+    {
+      //with arrays from arraymalloc2dpair the six rows read here are
+      //adjacent in memory
+
+      Float_t * restrict pn = psinew[i];
+      Float_t * restrict zn = zetnew[i];
+
+      const Float_t * restrict pm = psi[i-1];
+      const Float_t * restrict p0 = psi[i];
+      const Float_t * restrict pp = psi[i+1];
+
+      const Float_t * restrict zm = zet[i-1];
+      const Float_t * restrict z0 = zet[i];
+      const Float_t * restrict zp = zet[i+1];
+
+#pragma omp simd reduction(+:dsq) private(pnew,znew,tmp)
+      for(j=jstart;j<=jstop;j++)
+	{
+	  pnew = 0.25f*(pm[j]+pp[j]+p0[j-1]+p0[j+1] - z0[j]);
+
+	  znew = 0.25f*(zm[j]+zp[j]+z0[j-1]+z0[j+1])
+	    - r16*(  (p0[j+1]-p0[j-1])*(zp[j]-zm[j])
+		   - (pp[j]-pm[j])*(z0[j+1]-z0[j-1]) );
+
+	  tmp  = pnew-p0[j];
+	  dsq += tmp*tmp;
+	  tmp  = znew-z0[j];
+	  dsq += tmp*tmp;
+
+	  pn[j] = pnew;
+	  zn[j] = znew;
+	}
+    }
+
+  timerstop(TIMERSTENCIL);
+
+  return dsq;
+}
+
+//one iteration of the vorticity equations, with the arrays from
+//arraymalloc2dpair so that one halo swap serves both. Leaves the
+//result in *psi and *zet, with the zeta boundary conditions updated.
+//Returns the squared change
+
+double jacobivortiterate(Float_t ***psi, Float_t ***zet,
+			 Float_t ***psitmp, Float_t ***zettmp,
+			 double re, const decomp *dc)
+{
+  MPI_Request req[HALONREQ];
+  Float_t **tmp;
+  double dsq;
+
+  int m = dc->lm;
+  int n = dc->ln;
+
+  haloswappairbegin(*psi,dc,req);
+
+  dsq = jacobistepvort(*zettmp,*psitmp,*zet,*psi,2,m-1,2,n-1,re);
+
+  haloswapend(req);
+
+  dsq += jacobistepvort(*zettmp,*psitmp,*zet,*psi,1,1,1,n,re);
+  if (m > 1) dsq += jacobistepvort(*zettmp,*psitmp,*zet,*psi,m,m,1,n,re);
+
+  dsq += jacobistepvort(*zettmp,*psitmp,*zet,*psi,2,m-1,1,1,re);
+  if (n > 1) dsq += jacobistepvort(*zettmp,*psitmp,*zet,*psi,2,m-1,n,n,re);
+
+  tmp=*psi;
+  *psi=*psitmp;
+  *psitmp=tmp;
+
+  tmp=*zet;
+  *zet=*zettmp;
+  *zettmp=tmp;
+
+  boundaryzet(*zet,*psi,dc);
+
+  return dsq;
+}
+
+double deltasq(Float_t **newarr, Float_t **oldarr, int m, int n)
 {
   int i, j;
 
   double dsq=0.0;
   double tmp;
 
+  timerstart(TIMERRESIDUAL);
+
+#pragma omp parallel for schedule(static) private(j,tmp) reduction(+:dsq)
   for(i=1;i<=m;i++)
     {
       for(j=1;j<=n;j++)
@@ -31,5 +422,38 @@ double deltasq(double **newarr, double **oldarr, int m, int n)
         }
     }
 
+  timerstop(TIMERRESIDUAL);
+
   return dsq;
 }
+
+//local sum of squared residuals of the psi equation, the neighbours
+//minus 4 psi, worked out in double whatever the precision of psi. The
+//halos must be up to date
+
+double residualsq(Float_t **psi, int m, int n)
+{
+  int i, j;
+
+  double rsq=0.0;
+  double r;
+
+  timerstart(TIMERRESIDUAL);
+
+#pragma omp parallel for schedule(static) private(j,r) reduction(+:rsq) \
+  if(m*n >= JACOBIOMPMIN)
+  for(i=1;i<=m;i++)
+    {
+      for(j=1;j<=n;j++)
+	{
+	  r = (double) psi[i-1][j] + (double) psi[i+1][j]
+	    + (double) psi[i][j-1] + (double) psi[i][j+1] - 4.0*psi[i][j];
+
+	  rsq += r*r;
+	}
+    }
+
+  timerstop(TIMERRESIDUAL);
+
+  return rsq;
+}
@@ -1,7 +1,29 @@
-void jacobistep(double **psinew, double **psi, int m, int n);
+//smallest number of points worth updating with more than one thread
 
-void jacobistepvort(double **zetnew, double **psinew,
-		    double **zet,    double** psi,
-		    int m, int n, double re);
+#define JACOBIOMPMIN 4096
 
-double deltasq(double **newarr, double **oldarr, int m, int n);
+void jacobistep(Float_t **psinew, Float_t **psi, int m, int n);
+
+double jacobistepblock(Float_t **psinew, Float_t **psi,
+		       int istart, int istop, int jstart, int jstop);
+
+double jacobistepedges(Float_t **psinew, Float_t **psi, int m, int n);
+
+double jacobistepwave(Float_t **psinew, Float_t **psi, int nstep,
+		      const decomp *dc);
+
+double jacobiiterate(Float_t ***psi, Float_t ***psitmp, int nstep,
+		     double omega, const decomp *dc);
+
+double jacobistepvort(Float_t **zetnew, Float_t **psinew,
+		      Float_t **zet,    Float_t **psi,
+		      int istart, int istop, int jstart, int jstop,
+		      double re);
+
+double jacobivortiterate(Float_t ***psi, Float_t ***zet,
+			 Float_t ***psitmp, Float_t ***zettmp,
+			 double re, const decomp *dc);
+
+double deltasq(Float_t **newarr, Float_t **oldarr, int m, int n);
+
+double residualsq(Float_t **psi, int m, int n);
@@ -0,0 +1,632 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#include "arraymalloc.h"
+#include "precision.h"
+#include "decomp.h"
+#include "boundary.h"
+#include "jacobi.h"
+#include "sor.h"
+#include "mg.h"
+#include "timer.h"
+
+//Every level solves sum of neighbours - 4u = g, where g is h*h times
+//the right hand side. The finest level is psi itself with g = 0 and
+//the boundary values in its halo; coarser levels hold corrections,
+//which are zero on the boundary. The grid is cell centred: coarse
+//point I covers fine points 2I-1 and 2I in each direction, so the
+//boundary gets closer to the first point, in units of the spacing, on
+//each coarser level. The halo of a coarse level holds ghost values
+//that extrapolate linearly to zero on the boundary. Coarse blocks are
+//on the same processes as the fine blocks they cover, see decompcoarsen,
+//and the fine points that are over the edge of a block are reached
+//through the halo
+
+typedef struct
+{
+  const decomp *dc;          //decomposition of this level
+  decomp       own;          //storage for dc below the finest level
+  Float_t      **u;          //solution, or correction on coarse levels
+  Float_t      **g;          //right hand side
+  Float_t      **r;          //residual, if restriction needs its halo
+  double       ghost;        //ghost value as a multiple of the next point
+} mglevel;
+
+static mglevel level[MGMAXLEVEL];
+
+static int nlevel;           //number of levels on this process
+static int ngather;          //first level on rank 0 only, -1 if none
+
+//the gathered levels are on a communicator of rank 0 only. Rank 0
+//keeps the position of every block of the last distributed level
+
+static MPI_Comm comm0 = MPI_COMM_NULL;
+static int    *gblock, *gcount, *gdispl;
+static Float_t *gbuf, *lbuf;
+
+//zero the whole of x including its halo
+
+static void mgzero(Float_t **x, const decomp *dc)
+{
+  int i;
+
+  for (i=0; i<=dc->lm+1; i++)
+    {
+      memset(&x[i][0], 0, (dc->ln+2)*sizeof(Float_t));
+    }
+}
+
+//red-black relaxation of one colour, over-relaxed by omega
+
+static void mgsweep(Float_t **u, Float_t **g, double omega, int colour,
+		    const decomp *dc)
+{
+  int i, j, j0;
+
+  int m = dc->lm;
+  int n = dc->ln;
+
+  int par = (dc->istart + dc->jstart) % 2;
+
+  const Float_t om = omega;
+
+  timerstart(TIMERSTENCIL);
+
+#pragma omp parallel for schedule(static) private(j,j0) if(m*n >= 2*JACOBIOMPMIN)
+  for(i=1;i<=m;i++)
+    {
+      Float_t * restrict p0 = u[i];
+
+      const Float_t * restrict pm = u[i-1];
+      const Float_t * restrict pp = u[i+1];
+      const Float_t * restrict f  = g[i];
+
+      j0 = 1 + (par+i+1+colour) % 2;
+
+#pragma omp simd
+      for(j=j0;j<=n;j+=2)
+	{
+	  p0[j] += om*(0.25f*(pm[j]+pp[j]+p0[j-1]+p0[j+1]-f[j]) - p0[j]);
+	}
+    }
+
+  timerstop(TIMERSTENCIL);
+}
+
+//swap the halo of a level and set the ghost values at the edges of
+//the grid. Ghost columns are set before the swap and ghost rows after
+//it, so that corners, which only interpolation needs, are right too
+
+static void mghalo(mglevel *lv, int corners)
+{
+  int i, j;
+
+  Float_t **u = lv->u;
+
+  int m = lv->dc->lm;
+  int n = lv->dc->ln;
+
+  //the halo of the finest level holds the real boundary values
+
+  if (lv == &level[0])
+    {
+      haloswap(u, lv->dc);
+      return;
+    }
+
+  for (i=1; i<=m; i++)
+    {
+      if (lv->dc->down == MPI_PROC_NULL) u[i][0]   = lv->ghost*u[i][1];
+      if (lv->dc->up   == MPI_PROC_NULL) u[i][n+1] = lv->ghost*u[i][n];
+    }
+
+  if (corners)
+    {
+      haloswapcorners(u, lv->dc);
+    }
+  else
+    {
+      haloswap(u, lv->dc);
+    }
+
+  for (j=0; j<=n+1; j++)
+    {
+      if (lv->dc->left  == MPI_PROC_NULL) u[0][j]   = lv->ghost*u[1][j];
+      if (lv->dc->right == MPI_PROC_NULL) u[m+1][j] = lv->ghost*u[m][j];
+    }
+}
+
+static void mgsmooth(mglevel *lv, double omega, int nsweep)
+{
+  int s, colour;
+
+  for (s=0; s<nsweep; s++)
+    {
+      for (colour=0; colour<2; colour++)
+	{
+	  mghalo(lv, 0);
+	  mgsweep(lv->u, lv->g, omega, colour, lv->dc);
+	}
+    }
+}
+
+//right hand side of the coarse level lc from the residual of the fine
+//level lf, whose halo must be up to date. The coarse operator is that
+//of a grid twice as wide, so the sum of the 4 fine residuals is used
+//rather than their mean. Coarse point ic covers fine points 2ic-1+io
+//and 2ic+io of the block, where io is 1 if the block starts on an even
+//global index. If the last of those is in the halo for some process,
+//lf->r is set and the fine residual is worked out on the block first
+//and then swapped
+
+static void mgrestrict(mglevel *lc, mglevel *lf)
+{
+  int ic, jc, i, j, a, b;
+
+  Float_t **u = lf->u;
+  Float_t **g = lf->g;
+  Float_t **res = lf->r;
+
+  int io = 2*lc->dc->istart - lf->dc->istart - 1;
+  int jo = 2*lc->dc->jstart - lf->dc->jstart - 1;
+
+  double r;
+
+  if (res != NULL)
+    {
+      timerstart(TIMERRESIDUAL);
+
+#pragma omp parallel for schedule(static) private(j) \
+  if(lf->dc->lm*lf->dc->ln >= JACOBIOMPMIN)
+      for (i=1; i<=lf->dc->lm; i++)
+	{
+	  for (j=1; j<=lf->dc->ln; j++)
+	    {
+	      res[i][j] = g[i][j] - (u[i-1][j]+u[i+1][j]+u[i][j-1]+u[i][j+1]
+				     - 4.0f*u[i][j]);
+	    }
+	}
+
+      timerstop(TIMERRESIDUAL);
+
+      haloswapcorners(res, lf->dc);
+    }
+
+  timerstart(TIMERRESIDUAL);
+
+#pragma omp parallel for schedule(static) private(jc,i,j,a,b,r) \
+  if(lc->dc->lm*lc->dc->ln >= JACOBIOMPMIN)
+  for (ic=1; ic<=lc->dc->lm; ic++)
+    {
+      for (jc=1; jc<=lc->dc->ln; jc++)
+	{
+	  r = 0.0;
+
+	  for (a=0; a<2; a++)
+	    {
+	      for (b=0; b<2; b++)
+		{
+		  i = 2*ic-1+io+a;
+		  j = 2*jc-1+jo+b;
+
+		  if (res != NULL)
+		    {
+		      r += res[i][j];
+		    }
+		  else
+		    {
+		      r += g[i][j] - (u[i-1][j]+u[i+1][j]+u[i][j-1]+u[i][j+1]
+				      - 4.0f*u[i][j]);
+		    }
+		}
+	    }
+
+	  lc->g[ic][jc] = r;
+	}
+    }
+
+  timerstop(TIMERRESIDUAL);
+}
+
+//add the bilinear interpolation of the coarse correction to the fine
+//level
+
+static void mgprolong(mglevel *lf, mglevel *lc)
+{
+  int i, j, ic, io, jc, jo;
+
+  Float_t **uc = lc->u;
+
+  //global indices of the first points of the fine and coarse blocks
+
+  int is = lf->dc->istart, ics = lc->dc->istart;
+  int js = lf->dc->jstart, jcs = lc->dc->jstart;
+
+  mghalo(lc, 1);
+
+  timerstart(TIMERSTENCIL);
+
+#pragma omp parallel for schedule(static) private(j,ic,io,jc,jo) \
+  if(lf->dc->lm*lf->dc->ln >= JACOBIOMPMIN)
+  for (i=1; i<=lf->dc->lm; i++)
+    {
+      //nearest coarse row, and the other one on this side of it; the
+      //first fine row of a block may be nearest to the coarse halo
+
+      ic = (i+is)/2 - ics + 1;
+      io = ((i+is)%2 == 0) ? ic-1 : ic+1;
+
+      for (j=1; j<=lf->dc->ln; j++)
+	{
+	  jc = (j+js)/2 - jcs + 1;
+	  jo = ((j+js)%2 == 0) ? jc-1 : jc+1;
+
+	  lf->u[i][j] += 0.0625f*(9.0f*uc[ic][jc] + 3.0f*uc[io][jc]
+				 + 3.0f*uc[ic][jo] + uc[io][jo]);
+	}
+    }
+
+  timerstop(TIMERSTENCIL);
+}
+
+//residual of level lv packed into buf, the halo must be up to date
+
+static void mgresidual(Float_t *buf, const mglevel *lv)
+{
+  int i, j;
+
+  Float_t **u = lv->u;
+  Float_t **g = lv->g;
+
+  timerstart(TIMERRESIDUAL);
+
+  for (i=1; i<=lv->dc->lm; i++)
+    {
+      for (j=1; j<=lv->dc->ln; j++)
+	{
+	  *buf++ = g[i][j] - (u[i-1][j]+u[i+1][j]+u[i][j-1]+u[i][j+1]
+			      - 4.0f*u[i][j]);
+	}
+    }
+
+  timerstop(TIMERRESIDUAL);
+}
+
+static void mgcycle(int l);
+
+//coarse grid correction of the last distributed level l from the
+//same grid gathered onto rank 0
+
+static void mggather(int l)
+{
+  mglevel *lv = &level[l];
+  mglevel *lg = &level[l+1];
+
+  int rank, size, r, i, j, k;
+
+  MPI_Comm_rank(lv->dc->comm, &rank);
+  MPI_Comm_size(lv->dc->comm, &size);
+
+  mgresidual(lbuf, lv);
+
+  MPI_Gatherv(lbuf, lv->dc->lm*lv->dc->ln, MPI_FLOAT_T,
+	      gbuf, gcount, gdispl, MPI_FLOAT_T, 0, lv->dc->comm);
+
+  if (rank == 0)
+    {
+      for (r=0, k=0; r<size; r++)
+	{
+	  for (i=0; i<gblock[4*r+2]; i++)
+	    {
+	      for (j=0; j<gblock[4*r+3]; j++)
+		{
+		  lg->g[gblock[4*r]+i][gblock[4*r+1]+j] = gbuf[k++];
+		}
+	    }
+	}
+
+      mgzero(lg->u, lg->dc);
+
+      mgcycle(l+1);
+
+      for (r=0, k=0; r<size; r++)
+	{
+	  for (i=0; i<gblock[4*r+2]; i++)
+	    {
+	      for (j=0; j<gblock[4*r+3]; j++)
+		{
+		  gbuf[k++] = lg->u[gblock[4*r]+i][gblock[4*r+1]+j];
+		}
+	    }
+	}
+    }
+
+  MPI_Scatterv(gbuf, gcount, gdispl, MPI_FLOAT_T,
+	       lbuf, lv->dc->lm*lv->dc->ln, MPI_FLOAT_T, 0, lv->dc->comm);
+
+  for (i=1, k=0; i<=lv->dc->lm; i++)
+    {
+      for (j=1; j<=lv->dc->ln; j++)
+	{
+	  lv->u[i][j] += lbuf[k++];
+	}
+    }
+}
+
+//V-cycle from level l down
+
+static void mgcycle(int l)
+{
+  mglevel *lv = &level[l];
+
+  //solve the coarsest level with enough SOR sweeps to converge
+
+  if (l == nlevel-1 && l+1 != ngather)
+    {
+      mgsmooth(lv, soromega(lv->dc->m, lv->dc->n), 2*(lv->dc->m+lv->dc->n));
+      return;
+    }
+
+  mgsmooth(lv, 1.0, MGNPRE);
+
+  mghalo(lv, 0);
+
+  if (l+1 == ngather)
+    {
+      mggather(l);
+    }
+  else
+    {
+      mgrestrict(&level[l+1], lv);
+
+      mgzero(level[l+1].u, level[l+1].dc);
+
+      mgcycle(l+1);
+
+      mgprolong(lv, &level[l+1]);
+    }
+
+  mgsmooth(lv, 1.0, MGNPOST);
+}
+
+//set up the gather from level l onto rank 0
+
+static void mggathersetup(int l)
+{
+  const decomp *dc = level[l].dc;
+
+  int rank, size, r;
+  int block[4];
+
+  MPI_Comm_rank(dc->comm, &rank);
+  MPI_Comm_size(dc->comm, &size);
+
+  MPI_Comm_split(dc->comm, rank == 0 ? 0 : MPI_UNDEFINED, 0, &comm0);
+
+  block[0] = dc->istart;
+  block[1] = dc->jstart;
+  block[2] = dc->lm;
+  block[3] = dc->ln;
+
+  if (rank == 0)
+    {
+      gblock = (int *) malloc(4*size*sizeof(int));
+      gcount = (int *) malloc(size*sizeof(int));
+      gdispl = (int *) malloc(size*sizeof(int));
+      gbuf   = (Float_t *) malloc((size_t) dc->m*dc->n*sizeof(Float_t));
+    }
+
+  lbuf = (Float_t *) malloc((size_t) dc->lm*dc->ln*sizeof(Float_t));
+
+  MPI_Gather(block, 4, MPI_INT, gblock, 4, MPI_INT, 0, dc->comm);
+
+  if (rank == 0)
+    {
+      for (r=0; r<size; r++)
+	{
+	  gcount[r] = gblock[4*r+2]*gblock[4*r+3];
+	  gdispl[r] = (r == 0) ? 0 : gdispl[r-1] + gcount[r-1];
+	}
+    }
+}
+
+//whether restriction from lf to its coarse level lc reaches into the
+//halo of lf on any process, and so needs the fine residual swapped
+
+static int mgrestricthalo(const decomp *lf, const decomp *lc)
+{
+  int mine, any;
+
+  mine = (2*lc->istart-1 + 2*lc->lm-1 > lf->istart + lf->lm-1) ||
+         (2*lc->jstart-1 + 2*lc->ln-1 > lf->jstart + lf->ln-1);
+
+  MPI_Allreduce(&mine, &any, 1, MPI_INT, MPI_LOR, lf->comm);
+
+  return any;
+}
+
+//build the hierarchy of levels below the grid of dc. The grid is
+//halved on the same processes while it is even and has at least
+//MGGATHERMIN points, and no block comes out empty; the rest is then
+//gathered onto rank 0
+
+void mgsetup(const decomp *dc)
+{
+  const decomp *cur;
+
+  int l, rank, size, even, small, empty, minsize;
+
+  //distance from the boundary to the first point of a level, in units
+  //of its grid spacing
+
+  double dist = 1.0;
+
+  MPI_Comm_rank(dc->comm, &rank);
+  MPI_Comm_size(dc->comm, &size);
+
+  level[0].dc = dc;
+  level[0].u  = NULL;
+  level[0].g  = (Float_t **) arraymalloc2dhalo(dc->lm, dc->ln, 1, sizeof(Float_t), 1);
+  level[0].r  = NULL;
+
+  mgzero(level[0].g, dc);
+
+  ngather = -1;
+
+  for (l=0; l+1 < MGMAXLEVEL; l++)
+    {
+      cur = level[l].dc;
+
+      //the global grid is the same on every process, so they all agree
+
+      even  = (cur->m%2 == 0 && cur->n%2 == 0);
+      small = ((long) cur->m*cur->n < MGGATHERMIN);
+
+      if (ngather < 0 && size > 1)
+	{
+	  empty = 1;
+
+	  if (even && !small)
+	    {
+	      decompcoarsen(&level[l+1].own, cur);
+
+	      minsize = level[l+1].own.lm < level[l+1].own.ln ?
+		level[l+1].own.lm : level[l+1].own.ln;
+
+	      MPI_Allreduce(MPI_IN_PLACE, &minsize, 1, MPI_INT, MPI_MIN, cur->comm);
+
+	      empty = (minsize < 1);
+
+	      if (empty) decompfree(&level[l+1].own);
+	    }
+
+	  if (!empty)
+	    {
+	      if (mgrestricthalo(cur, &level[l+1].own))
+		{
+		  level[l].r = (Float_t **) arraymalloc2dhalo(cur->lm, cur->ln, 1,
+							      sizeof(Float_t), 1);
+		  mgzero(level[l].r, cur);
+		}
+
+	      dist = 0.5*(dist+0.5);
+	    }
+	  else
+	    {
+	      mggathersetup(l);
+
+	      ngather = l+1;
+
+	      if (rank != 0) break;
+
+	      decompcreate(&level[l+1].own, cur->m, cur->n, 1, comm0);
+	    }
+	}
+      else
+	{
+	  if (!even) break;
+
+	  decompcoarsen(&level[l+1].own, cur);
+	  dist = 0.5*(dist+0.5);
+	}
+
+      level[l+1].ghost = 1.0 - 1.0/dist;
+
+      level[l+1].dc = &level[l+1].own;
+
+      level[l+1].u = (Float_t **) arraymalloc2dhalo(level[l+1].dc->lm, level[l+1].dc->ln,
+						    1, sizeof(Float_t), 1);
+      level[l+1].g = (Float_t **) arraymalloc2dhalo(level[l+1].dc->lm, level[l+1].dc->ln,
+						    1, sizeof(Float_t), 1);
+      level[l+1].r = NULL;
+
+      mgzero(level[l+1].u, level[l+1].dc);
+    }
+
+  nlevel = l+1;
+
+  if (rank == 0)
+    {
+      printf("Multigrid with %d levels, coarsest grid %d x %d",
+	     nlevel, level[nlevel-1].dc->m, level[nlevel-1].dc->n);
+
+      if (ngather > 0)
+	{
+	  printf(", gathered onto one process from %d x %d",
+		 level[ngather].dc->m, level[ngather].dc->n);
+	}
+
+      printf("\n");
+
+      if (ngather == 1)
+	{
+	  printf("Note: the %d x %d grid cannot be coarsened on %d processes, so every\n"
+		 "V-cycle is gathered onto rank 0 and runs there alone\n",
+		 dc->m, dc->n, size);
+	}
+    }
+}
+
+//smoother interface: nstep V-cycles on psi, using psitmp to keep the
+//old values. Returns the squared change of the last cycle. omega is
+//not used, the levels are relaxed with Gauss-Seidel
+
+double mgiterate(Float_t ***psi, Float_t ***psitmp, int nstep,
+		 double omega, const decomp *dc)
+{
+  int s, i;
+
+  double dsq=0.0;
+
+  level[0].u = *psi;
+
+  for (s=0; s<nstep; s++)
+    {
+      timerstart(TIMERCOPY);
+
+      for (i=1; i<=dc->lm; i++)
+	{
+	  memcpy(&(*psitmp)[i][1], &(*psi)[i][1], dc->ln*sizeof(Float_t));
+	}
+
+      timerstop(TIMERCOPY);
+
+      mgcycle(0);
+
+      dsq = deltasq(*psi, *psitmp, dc->lm, dc->ln);
+    }
+
+  return dsq;
+}
+
+void mgfinish(void)
+{
+  int l;
+
+  for (l=0; l<nlevel; l++)
+    {
+      if (level[l].r != NULL) arrayfree2dhalo((void **) level[l].r, 1);
+
+      if (l == 0) continue;
+
+      arrayfree2dhalo((void **) level[l].u, 1);
+      arrayfree2dhalo((void **) level[l].g, 1);
+
+      decompfree(&level[l].own);
+    }
+
+  arrayfree2dhalo((void **) level[0].g, 1);
+
+  if (ngather > 0)
+    {
+      free(lbuf);
+      free(gbuf);
+      free(gblock);
+      free(gcount);
+      free(gdispl);
+    }
+
+  if (comm0 != MPI_COMM_NULL) MPI_Comm_free(&comm0);
+}
@@ -0,0 +1,22 @@
+//geometric multigrid for the psi equation. Levels coarsen by 2 in
+//both directions on the same process grid for as long as the global
+//grid is even and not too small; only the rest of the hierarchy is
+//then gathered onto rank 0
+
+#define MGMAXLEVEL 32
+
+//relaxation sweeps before and after the coarse grid correction
+
+#define MGNPRE  2
+#define MGNPOST 2
+
+//gather the grid onto one process once it has fewer points
+
+#define MGGATHERMIN 1024
+
+void mgsetup(const decomp *dc);
+
+double mgiterate(Float_t ***psi, Float_t ***psitmp, int nstep,
+		 double omega, const decomp *dc);
+
+void mgfinish(void);
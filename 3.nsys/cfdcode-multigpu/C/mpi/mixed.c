@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#include "arraymalloc.h"
+#include "precision.h"
+#include "decomp.h"
+#include "boundary.h"
+#include "jacobi.h"
+#include "mixed.h"
+#include "timer.h"
+
+//Jacobi with iterative refinement. Each call works out the residual r
+//of psi in double, then does nstep Jacobi sweeps in float on the
+//correction equation A e = r from e = 0, with e = 0 on the boundary,
+//and adds e to psi in double. In exact arithmetic this is the same as
+//nstep Jacobi sweeps on psi, but the sweeps stream floats, and swap
+//halos of half the size, while the rounding errors of float only
+//affect the correction and so do not limit the accuracy of psi. The
+//refinement costs about as much as a double sweep, so it is done every
+//-R sweeps, not every sweep; the halo of psi stays at depth 1 as the
+//float sweeps swap the halo of e
+
+//the correction and its next value, and the residual
+
+static float **e, **etmp, **res;
+
+//float columns of the correction, and persistent requests for the
+//halo swap of each of e and etmp
+
+static MPI_Datatype fcoltype;
+static MPI_Request  ereq[2][HALONREQ];
+
+static void mixedhaloinit(MPI_Request *req, float **x, const decomp *dc)
+{
+  int m = dc->lm;
+  int n = dc->ln;
+  int tag=1;
+
+  MPI_Recv_init(&x[0][1],  n,MPI_FLOAT, dc->left, tag,dc->comm,&req[0]);
+  MPI_Recv_init(&x[m+1][1],n,MPI_FLOAT, dc->right,tag,dc->comm,&req[1]);
+  MPI_Recv_init(&x[1][0],  1,fcoltype,  dc->down, tag,dc->comm,&req[2]);
+  MPI_Recv_init(&x[1][n+1],1,fcoltype,  dc->up,   tag,dc->comm,&req[3]);
+
+  MPI_Send_init(&x[m][1],  n,MPI_FLOAT, dc->right,tag,dc->comm,&req[4]);
+  MPI_Send_init(&x[1][1],  n,MPI_FLOAT, dc->left, tag,dc->comm,&req[5]);
+  MPI_Send_init(&x[1][n],  1,fcoltype,  dc->up,   tag,dc->comm,&req[6]);
+  MPI_Send_init(&x[1][1],  1,fcoltype,  dc->down, tag,dc->comm,&req[7]);
+}
+
+void mixedsetup(const decomp *dc)
+{
+  int lm = dc->lm;
+  int ln = dc->ln;
+
+  e    = (float **) arraymalloc2dhalo(lm,ln,1,sizeof(float),1);
+  etmp = (float **) arraymalloc2dhalo(lm,ln,1,sizeof(float),1);
+  res  = (float **) arraymalloc2dhalo(lm,ln,1,sizeof(float),1);
+
+  if (e == NULL || etmp == NULL || res == NULL)
+    {
+      printf("ERROR: failed to allocate mixed precision arrays\n");
+      MPI_Abort(dc->comm,1);
+    }
+
+  MPI_Type_vector(lm, 1, arraypad2d(ln+2, sizeof(float)), MPI_FLOAT, &fcoltype);
+  MPI_Type_commit(&fcoltype);
+
+  mixedhaloinit(ereq[0],e,dc);
+  mixedhaloinit(ereq[1],etmp,dc);
+}
+
+//one float sweep of enew = (r + neighbours of e)/4 on
+//istart..istop x jstart..jstop, returning the squared change
+
+static double mixedblock(float **enew, float **eold,
+			 int istart, int istop, int jstart, int jstop)
+{
+  int i, j;
+
+  double dsq=0.0;
+  float new, tmp;
+
+  timerstart(TIMERSTENCIL);
+
+#pragma omp parallel for schedule(static) private(j,new,tmp) reduction(+:dsq) \
+  if((istop-istart+1)*(jstop-jstart+1) >= JACOBIOMPMIN)
+  for(i=istart;i<=istop;i++)
+    {
+      float * restrict pnew = enew[i];
+
+      const float * restrict pm = eold[i-1];
+      const float * restrict p0 = eold[i];
+      const float * restrict pp = eold[i+1];
+      const float * restrict r  = res[i];
+
+#pragma omp simd reduction(+:dsq) private(new,tmp)
+      for(j=jstart;j<=jstop;j++)
+	{
+	  new=0.25f*(r[j]+pm[j]+pp[j]+p0[j-1]+p0[j+1]);
+
+	  tmp = new-p0[j];
+	  dsq += tmp*tmp;
+
+	  pnew[j]=new;
+	}
+    }
+
+  timerstop(TIMERSTENCIL);
+
+  return dsq;
+}
+
+//smoother interface: nstep sweeps and one refinement of psi. Returns
+//the squared change of psi over the last sweep. psitmp and omega are
+//not used
+
+double mixediterate(Float_t ***psi, Float_t ***psitmp, int nstep,
+		    double omega, const decomp *dc)
+{
+  Float_t **x = *psi;
+  float **tmp;
+  double dsq=0.0;
+  int i, j, s, cur;
+
+  int m = dc->lm;
+  int n = dc->ln;
+
+  //residual in double, rounded to float only once it is small
+
+  haloswap(x,dc);
+
+  timerstart(TIMERRESIDUAL);
+
+#pragma omp parallel for schedule(static) private(j) if(m*n >= JACOBIOMPMIN)
+  for (i=1; i<=m; i++)
+    {
+      for (j=1; j<=n; j++)
+	{
+	  res[i][j] = x[i-1][j]+x[i+1][j]+x[i][j-1]+x[i][j+1] - 4.0*x[i][j];
+	}
+
+      memset(&e[i][1], 0, n*sizeof(float));
+    }
+
+  timerstop(TIMERRESIDUAL);
+
+  //the halos of e are only zero at the edges of the grid, where no
+  //messages overwrite them; e and etmp swap roles after each sweep, so
+  //cur says which set of requests goes with e
+
+  cur = 0;
+
+  for (s=0; s<nstep; s++)
+    {
+      timerstart(TIMERHALO);
+      MPI_Startall(HALONREQ,ereq[cur]);
+      timerstop(TIMERHALO);
+
+      dsq = mixedblock(etmp,e,2,m-1,2,n-1);
+
+      timerstart(TIMERHALO);
+      MPI_Waitall(HALONREQ,ereq[cur],MPI_STATUSES_IGNORE);
+      timerstop(TIMERHALO);
+
+      dsq += mixedblock(etmp,e,1,1,1,n);
+      if (m > 1) dsq += mixedblock(etmp,e,m,m,1,n);
+
+      dsq += mixedblock(etmp,e,2,m-1,1,1);
+      if (n > 1) dsq += mixedblock(etmp,e,2,m-1,n,n);
+
+      tmp=e;
+      e=etmp;
+      etmp=tmp;
+
+      cur = 1-cur;
+    }
+
+  //the correction is added in double
+
+  timerstart(TIMERCOPY);
+
+#pragma omp parallel for schedule(static) private(j) if(m*n >= JACOBIOMPMIN)
+  for (i=1; i<=m; i++)
+    {
+      for (j=1; j<=n; j++)
+	{
+	  x[i][j] += e[i][j];
+	}
+    }
+
+  timerstop(TIMERCOPY);
+
+  //keep the requests paired with their arrays for the next call
+
+  if (cur == 1)
+    {
+      tmp=e;
+      e=etmp;
+      etmp=tmp;
+    }
+
+  return dsq;
+}
+
+void mixedfinish(void)
+{
+  int i;
+
+  for (i=0; i<HALONREQ; i++)
+    {
+      MPI_Request_free(&ereq[0][i]);
+      MPI_Request_free(&ereq[1][i]);
+    }
+
+  MPI_Type_free(&fcoltype);
+
+  arrayfree2dhalo((void **) e,1);
+  arrayfree2dhalo((void **) etmp,1);
+  arrayfree2dhalo((void **) res,1);
+}
@@ -0,0 +1,9 @@
+//mixed precision Jacobi: the correction to psi is iterated in float,
+//and psi and its residual are kept in double
+
+void mixedsetup(const decomp *dc);
+
+double mixediterate(Float_t ***psi, Float_t ***psitmp, int nstep,
+		    double omega, const decomp *dc);
+
+void mixedfinish(void);
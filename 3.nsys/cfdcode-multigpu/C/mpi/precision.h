@@ -0,0 +1,12 @@
+//precision of the flow fields psi and zeta and of the solvers' work
+//arrays. Build with -DUSE_FLOAT for single precision, which halves the
+//memory traffic of the stencils and the bytes of every halo swap.
+//Sums over the grid, such as the error, are accumulated in double
+
+#ifdef USE_FLOAT
+    typedef float  Float_t;
+    #define MPI_FLOAT_T MPI_FLOAT
+#else
+    typedef double Float_t;
+    #define MPI_FLOAT_T MPI_DOUBLE
+#endif
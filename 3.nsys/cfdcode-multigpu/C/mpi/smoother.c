@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <string.h>
+#include <mpi.h>
+
+#include "precision.h"
+#include "decomp.h"
+#include "jacobi.h"
+#include "sor.h"
+#include "mg.h"
+#include "cg.h"
+#include "mixed.h"
+#include "smoother.h"
+
+static const smoother smoothers[] =
+  {
+    {"jacobi", 1, jacobiiterate, NULL,    NULL},
+    {"sor",    0, soriterate,    NULL,    NULL},
+    {"mg",     0, mgiterate,     mgsetup, mgfinish},
+#ifndef USE_FLOAT
+    //the recurrences of pipelined CG drift too far from the true
+    //residual in float to get below about 1e-4, and mixed precision
+    //needs psi in double
+    {"cg",     0, cgiterate,     cgsetup, cgfinish},
+    {"mixed",  0, mixediterate,  mixedsetup, mixedfinish},
+#endif
+  };
+
+#define NSMOOTHER (int) (sizeof(smoothers)/sizeof(smoother))
+
+//the smoother called name, or NULL if there is none
+
+const smoother *smootherfind(const char *name)
+{
+  int i;
+
+  for (i=0; i<NSMOOTHER; i++)
+    {
+      if (strcmp(name, smoothers[i].name) == 0) return &smoothers[i];
+    }
+
+  return NULL;
+}
+
+void smootherlist(void)
+{
+  int i;
+
+  for (i=0; i<NSMOOTHER; i++)
+    {
+      printf(" %s", smoothers[i].name);
+    }
+
+  printf("\n");
+}
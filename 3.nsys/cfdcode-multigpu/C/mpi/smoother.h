@@ -0,0 +1,22 @@
+//an iterative method for the psi equation. iterate() advances nstep
+//iterations and leaves the result in *psi, returning the local sum of
+//squared changes over the last iteration; *psitmp is workspace that
+//also holds the boundary values. nstep may only exceed 1 if deephalo
+//is set, when the iterations can use a single halo swap of depth nstep,
+//or for mixed, which swaps the halo every sweep and refines once per call.
+//setup() and finish(), if not NULL, are called before the first and
+//after the last iteration
+
+typedef struct
+{
+  const char *name;
+  int         deephalo;
+  double    (*iterate)(Float_t ***psi, Float_t ***psitmp, int nstep,
+		       double omega, const decomp *dc);
+  void      (*setup)(const decomp *dc);
+  void      (*finish)(void);
+} smoother;
+
+const smoother *smootherfind(const char *name);
+
+void smootherlist(void);
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <math.h>
+#include <mpi.h>
+
+#include "precision.h"
+#include "decomp.h"
+#include "boundary.h"
+#include "jacobi.h"
+#include "sor.h"
+#include "timer.h"
+
+//red-black successive over-relaxation. Points are coloured by the
+//parity of their global i+j, so the colouring is the same whatever the
+//decomposition. Each point of one colour only depends on points of
+//the other, so a colour can be updated in place, in any order and in
+//parallel, and a single halo swap is needed before each colour
+
+//update the points of one colour in istart..istop x jstart..jstop in
+//place, returning the squared change
+
+double sorblock(Float_t **psi, double omega, int colour,
+		int istart, int istop, int jstart, int jstop,
+		const decomp *dc)
+{
+  int i, j, j0;
+
+  //parity of the global index of local point [0][0]
+
+  int par = (dc->istart + dc->jstart) % 2;
+
+  double dsq=0.0;
+  Float_t new, tmp;
+
+  const Float_t om = omega;
+
+  timerstart(TIMERSTENCIL);
+
+#pragma omp parallel for schedule(static) private(j,j0,new,tmp) reduction(+:dsq) \
+  if((istop-istart+1)*(jstop-jstart+1) >= 2*JACOBIOMPMIN)
+  for(i=istart;i<=istop;i++)
+    {
+      Float_t * restrict p0 = psi[i];
+
+      const Float_t * restrict pm = psi[i-1];
+      const Float_t * restrict pp = psi[i+1];
+
+      //first point of the right colour in this row
+
+      j0 = jstart + (par+i+jstart+colour) % 2;
+
+      //every other point, so the ones read in the row are all of the
+      //other colour and none is written
+
+#pragma omp simd reduction(+:dsq) private(new,tmp)
+      for(j=j0;j<=jstop;j+=2)
+	{
+	  new = 0.25f*(pm[j]+pp[j]+p0[j-1]+p0[j+1]);
+
+	  tmp = om*(new-p0[j]);
+	  dsq += tmp*tmp;
+
+	  p0[j] += tmp;
+	}
+    }
+
+  timerstop(TIMERSTENCIL);
+
+  return dsq;
+}
+
+//one red-black iteration. As for Jacobi, the swap of each colour is
+//overlapped with the update of the points that do not need the halos
+
+double sorstep(Float_t **psi, double omega, const decomp *dc)
+{
+  MPI_Request req[HALONREQ];
+  int colour;
+
+  int m = dc->lm;
+  int n = dc->ln;
+
+  double dsq=0.0;
+
+  for (colour=0; colour<2; colour++)
+    {
+      haloswapbegin(psi,dc,req);
+
+      dsq += sorblock(psi,omega,colour,2,m-1,2,n-1,dc);
+
+      haloswapend(req);
+
+      dsq += sorblock(psi,omega,colour,1,1,1,n,dc);
+      if (m > 1) dsq += sorblock(psi,omega,colour,m,m,1,n,dc);
+
+      dsq += sorblock(psi,omega,colour,2,m-1,1,1,dc);
+      if (n > 1) dsq += sorblock(psi,omega,colour,2,m-1,n,n,dc);
+    }
+
+  return dsq;
+}
+
+//smoother interface: nstep iterations in place, psitmp is not used.
+//Returns the squared change of the last iteration
+
+double soriterate(Float_t ***psi, Float_t ***psitmp, int nstep,
+		  double omega, const decomp *dc)
+{
+  int s;
+
+  double dsq=0.0;
+
+  for (s=0; s<nstep; s++)
+    {
+      dsq = sorstep(*psi,omega,dc);
+    }
+
+  return dsq;
+}
+
+//optimal over-relaxation for the Laplacian on an m x n grid with the
+//boundary values fixed, from the spectral radius of Jacobi
+
+double soromega(int m, int n)
+{
+  double rho;
+
+  rho = 0.5*(cos(M_PI/(double)(m+1)) + cos(M_PI/(double)(n+1)));
+
+  return 2.0/(1.0 + sqrt(1.0-rho*rho));
+}
@@ -0,0 +1,10 @@
+double sorblock(Float_t **psi, double omega, int colour,
+		int istart, int istop, int jstart, int jstop,
+		const decomp *dc);
+
+double sorstep(Float_t **psi, double omega, const decomp *dc);
+
+double soriterate(Float_t ***psi, Float_t ***psitmp, int nstep,
+		  double omega, const decomp *dc);
+
+double soromega(int m, int n);
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#include "timer.h"
+
+int         timeron = TIMEROFF;
+timerregion timers[TIMERNREGION];
+
+static const char *timernames[TIMERNREGION] =
+  {"stencil", "residual", "copy", "halo", "io"};
+
+//the trace holds the region, start and stop of each event, with times
+//relative to when the timers were started
+
+static double *events = NULL;
+static int    nevent, ndropped;
+static double t0;
+
+void timerrecord(int region, double start, double stop)
+{
+  if (nevent == TIMERMAXEVENT)
+    {
+      ndropped++;
+      return;
+    }
+
+  events[3*nevent]   = region;
+  events[3*nevent+1] = start - t0;
+  events[3*nevent+2] = stop  - t0;
+
+  nevent++;
+}
+
+//start timing from now on all processes of comm
+
+void timerinit(int mode, MPI_Comm comm)
+{
+  memset(timers, 0, sizeof(timers));
+
+  nevent   = 0;
+  ndropped = 0;
+
+  if (mode == TIMERTRACE && events == NULL)
+    {
+      events = (double *) malloc(3*(size_t) TIMERMAXEVENT*sizeof(double));
+
+      if (events == NULL)
+	{
+	  printf("WARNING: no memory for the trace, timing totals only\n");
+	  mode = TIMERTOTAL;
+	}
+    }
+
+  MPI_Barrier(comm);
+
+  t0      = MPI_Wtime();
+  timeron = mode;
+}
+
+//minimum, mean and maximum over the processes of the time in each region
+
+void timerreport(MPI_Comm comm)
+{
+  double total[TIMERNREGION], tmin[TIMERNREGION], tmax[TIMERNREGION];
+  double tsum[TIMERNREGION];
+  long   count[TIMERNREGION], cmax[TIMERNREGION];
+  int    rank, size, r;
+
+  if (timeron == TIMEROFF) return;
+
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  for (r=0; r<TIMERNREGION; r++)
+    {
+      total[r] = timers[r].total;
+      count[r] = timers[r].count;
+    }
+
+  MPI_Reduce(total, tmin, TIMERNREGION, MPI_DOUBLE, MPI_MIN, 0, comm);
+  MPI_Reduce(total, tmax, TIMERNREGION, MPI_DOUBLE, MPI_MAX, 0, comm);
+  MPI_Reduce(total, tsum, TIMERNREGION, MPI_DOUBLE, MPI_SUM, 0, comm);
+  MPI_Reduce(count, cmax, TIMERNREGION, MPI_LONG,   MPI_MAX, 0, comm);
+
+  if (rank == 0)
+    {
+      printf("\nTime in each region over %d process(es), seconds\n", size);
+      printf("%-10s %12s %12s %12s %12s\n", "region", "calls", "min", "mean", "max");
+
+      for (r=0; r<TIMERNREGION; r++)
+	{
+	  printf("%-10s %12ld %12.6f %12.6f %12.6f\n", timernames[r], cmax[r],
+		 tmin[r], tsum[r]/size, tmax[r]);
+	}
+    }
+}
+
+//gather the events of every process to rank 0, which writes them to
+//filename in the Chrome trace event format, one track per process.
+//Times are in microseconds
+
+void timertrace(const char *filename, MPI_Comm comm)
+{
+  FILE *fp = NULL;
+  double *all = NULL;
+  int *counts = NULL, *displs = NULL;
+  int rank, size, r, i, n, first, dropped;
+
+  if (timeron != TIMERTRACE) return;
+
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &size);
+
+  n = 3*nevent;
+
+  MPI_Reduce(&ndropped, &dropped, 1, MPI_INT, MPI_SUM, 0, comm);
+
+  if (rank == 0)
+    {
+      counts = (int *) malloc(size*sizeof(int));
+      displs = (int *) malloc(size*sizeof(int));
+    }
+
+  MPI_Gather(&n, 1, MPI_INT, counts, 1, MPI_INT, 0, comm);
+
+  if (rank == 0)
+    {
+      displs[0] = 0;
+
+      for (r=1; r<size; r++)
+	{
+	  displs[r] = displs[r-1] + counts[r-1];
+	}
+
+      all = (double *) malloc(((size_t) displs[size-1]+counts[size-1]+1)*sizeof(double));
+    }
+
+  MPI_Gatherv(events, n, MPI_DOUBLE, all, counts, displs, MPI_DOUBLE, 0, comm);
+
+  if (rank == 0)
+    {
+      fp = fopen(filename, "w");
+
+      if (fp == NULL)
+	{
+	  printf("WARNING: cannot open trace file %s\n", filename);
+	}
+      else
+	{
+	  printf("\nWriting trace file %s\n", filename);
+
+	  if (dropped > 0)
+	    {
+	      printf("WARNING: %d event(s) did not fit in the trace\n", dropped);
+	    }
+
+	  fprintf(fp, "{\"traceEvents\":[\n");
+
+	  first = 1;
+
+	  for (r=0; r<size; r++)
+	    {
+	      fprintf(fp, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+		      "\"args\":{\"name\":\"rank %d\"}}", first ? "" : ",\n", r, r);
+	      first = 0;
+
+	      for (i=displs[r]; i<displs[r]+counts[r]; i+=3)
+		{
+		  fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":0,"
+			  "\"ts\":%.3f,\"dur\":%.3f}", timernames[(int) all[i]], r,
+			  1.0e6*all[i+1], 1.0e6*(all[i+2]-all[i+1]));
+		}
+	    }
+
+	  fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	  fclose(fp);
+	}
+
+      free(all);
+      free(counts);
+      free(displs);
+    }
+
+  free(events);
+  events = NULL;
+
+  timeron = TIMERTOTAL;
+}
@@ -0,0 +1,53 @@
+//timers for the regions of the hot path, always compiled in. When they
+//are off, timerstart() and timerstop() only test a flag. They must be
+//called outside parallel regions, and a region must not be nested in
+//itself. Collect totals with TIMERTOTAL, and also every start and stop
+//for a Chrome trace with TIMERTRACE
+
+enum {TIMERSTENCIL, TIMERRESIDUAL, TIMERCOPY, TIMERHALO, TIMERIO, TIMERNREGION};
+
+#define TIMEROFF   0
+#define TIMERTOTAL 1
+#define TIMERTRACE 2
+
+//most events kept per process for the trace, later ones are dropped
+
+#define TIMERMAXEVENT (1<<20)
+
+typedef struct
+{
+  double start;              //time the region was entered
+  double total;              //time spent in the region
+  long   count;              //number of times it was entered
+} timerregion;
+
+extern int         timeron;
+extern timerregion timers[TIMERNREGION];
+
+void timerrecord(int region, double start, double stop);
+
+static inline void timerstart(int region)
+{
+  if (timeron) timers[region].start = MPI_Wtime();
+}
+
+static inline void timerstop(int region)
+{
+  double stop;
+
+  if (timeron)
+    {
+      stop = MPI_Wtime();
+
+      timers[region].total += stop - timers[region].start;
+      timers[region].count++;
+
+      if (timeron == TIMERTRACE) timerrecord(region, timers[region].start, stop);
+    }
+}
+
+void timerinit(int mode, MPI_Comm comm);
+
+void timerreport(MPI_Comm comm);
+
+void timertrace(const char *filename, MPI_Comm comm);
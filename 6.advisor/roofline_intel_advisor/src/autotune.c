@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+#include "autotune.h"
+
+#define TUNE_LINE    512
+#define TUNE_MAXLINE 256
+#define TUNE_MODEL   128
+/* tile edges tried, each no larger than the dimension it tiles */
+#define TUNE_MINTILE 8
+#define TUNE_MAXTILE 512
+/* passes over the three tile edges, each edge tuned with the other two
+   fixed at their best so far */
+#define TUNE_NPASS   2
+/* runs of each configuration, the fastest one counts */
+#define TUNE_NTRIAL  2
+
+static const char *tune_orders[TUNE_NORDER] = {"ijk", "ikj", "jik", "jki", "kij", "kji"};
+
+/* the configuration the kernels had before the tuner, 32 x 32 x 32 tiles
+   in i-j-k order on every thread */
+void tune_default(tune_t *t) {
+  t->ar = t->ac = t->bc = 32;
+  t->order = TUNE_IJK;
+  t->nthreads = 0;
+}
+
+const char *tune_order_name(int order) {
+  return order >= 0 && order < TUNE_NORDER ? tune_orders[order] : "?";
+}
+
+/* model name from /proc/cpuinfo, with the separator of the cache taken out */
+const char *tune_cpu(void) {
+  static char model[TUNE_MODEL] = "";
+  if (model[0] != '\0')
+    return model;
+
+  strcpy(model, "unknown");
+  FILE *f = fopen("/proc/cpuinfo", "r");
+  if (f != NULL) {
+    char line[TUNE_LINE];
+    while (fgets(line, sizeof(line), f) != NULL) {
+      char *colon = strchr(line, ':');
+      if (colon == NULL || (strncmp(line, "model name", 10) != 0 && strncmp(line, "Hardware", 8) != 0))
+        continue;
+      char *s = colon + 1;
+      while (*s == ' ' || *s == '\t') ++s;
+      s[strcspn(s, "\n")] = '\0';
+      if (*s != '\0') {
+        snprintf(model, sizeof(model), "%s", s);
+        break;
+      }
+    }
+    fclose(f);
+  }
+  for (char *s = model; *s != '\0'; ++s)
+    if (*s == ';') *s = ',';
+  return model;
+}
+
+/* $MMP_TUNE_CACHE, else ~/.cache/mmp_tune.txt, else mmp_tune.txt here */
+const char *tune_file(void) {
+  static char path[TUNE_LINE] = "";
+  if (path[0] != '\0')
+    return path;
+
+  const char *env = getenv("MMP_TUNE_CACHE");
+  const char *home = getenv("HOME");
+  if (env != NULL && env[0] != '\0')
+    snprintf(path, sizeof(path), "%s", env);
+  else if (home != NULL && home[0] != '\0')
+    snprintf(path, sizeof(path), "%s/.cache/mmp_tune.txt", home);
+  else
+    snprintf(path, sizeof(path), "mmp_tune.txt");
+  return path;
+}
+
+/* "model;code;type;" the lines of this CPU, code and type start with */
+static void tune_key(char *key, size_t len, const char *code, const char *type) {
+  snprintf(key, len, "%s;%s;%s;", tune_cpu(), code, type);
+}
+
+/* configuration on a line that starts with key, 0 if it is one */
+static int tune_parse(const char *line, const char *key, tune_t *t) {
+  const size_t len = strlen(key);
+  char order[16];
+  tune_t c;
+  if (strncmp(line, key, len) != 0)
+    return -1;
+  if (sscanf(line + len, "%d %d %d %15s %d", &c.ar, &c.ac, &c.bc, order, &c.nthreads) != 5)
+    return -1;
+  if (c.ar <= 0 || c.ac <= 0 || c.bc <= 0 || c.nthreads < 0)
+    return -1;
+  for (c.order = 0; c.order < TUNE_NORDER; ++c.order)
+    if (strcmp(order, tune_orders[c.order]) == 0) {
+      *t = c;
+      return 0;
+    }
+  return -1;
+}
+
+/* t is left alone when the cache has no line for this CPU, code and type */
+int tune_load(const char *code, const char *type, tune_t *t) {
+  char key[TUNE_LINE], line[TUNE_LINE];
+  int found = -1;
+  FILE *f = fopen(tune_file(), "r");
+  if (f == NULL)
+    return -1;
+  tune_key(key, sizeof(key), code, type);
+  while (found != 0 && fgets(line, sizeof(line), f) != NULL)
+    found = tune_parse(line, key, t);
+  fclose(f);
+  return found;
+}
+
+/* the directory that holds path and its parents, like mkdir -p */
+static int tune_mkdirs(const char *path) {
+  char dir[TUNE_LINE];
+  snprintf(dir, sizeof(dir), "%s", path);
+  char *end = strrchr(dir, '/');
+  if (end == NULL || end == dir)
+    return 0;
+  *end = '\0';
+  for (char *s = dir + 1; ; ++s) {
+    if (*s != '/' && *s != '\0')
+      continue;
+    const char c = *s;
+    *s = '\0';
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+      return -1;
+    if (c == '\0')
+      return 0;
+    *s = c;
+  }
+}
+
+/* the lines of other CPUs, codes and types are kept, up to TUNE_MAXLINE;
+   the file is written aside and renamed so a reader never sees half of
+   it. -1 with errno set if it could not be written */
+int tune_save(const char *code, const char *type, const tune_t *t) {
+  const char *path = tune_file();
+  char key[TUNE_LINE], line[TUNE_LINE], tmp[TUNE_LINE + 8];
+  char (*lines)[TUNE_LINE] = malloc(sizeof(*lines) * TUNE_MAXLINE);
+  int nline = 0, ndrop = 0, err;
+  if (lines == NULL)
+    return -1;
+  tune_key(key, sizeof(key), code, type);
+
+  FILE *f = fopen(path, "r");
+  if (f != NULL) {
+    while (fgets(line, sizeof(line), f) != NULL) {
+      if (line[0] == '#' || strncmp(line, key, strlen(key)) == 0)
+        continue;
+      if (nline < TUNE_MAXLINE)
+        memcpy(lines[nline++], line, sizeof(line));
+      else
+        ++ndrop;
+    }
+    fclose(f);
+  }
+  if (ndrop > 0)
+    fprintf(stderr, "warning: %s has more than %d lines, the last %d are dropped\n",
+            path, TUNE_MAXLINE, ndrop);
+
+  if (tune_mkdirs(path) != 0) {
+    err = errno;
+    free(lines);
+    errno = err;
+    return -1;
+  }
+
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int) getpid());
+  f = fopen(tmp, "w");
+  if (f == NULL) {
+    err = errno;
+    free(lines);
+    errno = err;
+    return -1;
+  }
+  fprintf(f, "# model name;code;type;ar ac bc order nthreads\n");
+  for (int i = 0; i < nline; ++i)
+    fputs(lines[i], f);
+  fprintf(f, "%s%d %d %d %s %d\n", key, t->ar, t->ac, t->bc, tune_orders[t->order], t->nthreads);
+  free(lines);
+  if (fclose(f) != 0 || rename(tmp, path) != 0) {
+    err = errno;
+    remove(tmp);
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+/* threads to run with: the tuned count, but never more than OpenMP would
+   give, as when the cache was written with a larger OMP_NUM_THREADS */
+int tune_threads(const tune_t *t) {
+  const int max = omp_get_max_threads();
+  return t->nthreads > 0 && t->nthreads < max ? t->nthreads : max;
+}
+
+/* fastest of TUNE_NTRIAL runs of c, printed and kept in best if it beats it */
+static void tune_try(const tune_t *c, tune_t *best, double *tbest, double flops, tune_run_t run, void *ctx) {
+  double t = run(c, ctx);
+  for (int trial = 1; trial < TUNE_NTRIAL; ++trial) {
+    double s = run(c, ctx);
+    if (s < t) t = s;
+  }
+  printf("%5d %5d %5d %6s %8d %10.4f %10.2f%s\n", c->ar, c->ac, c->bc, tune_orders[c->order],
+         tune_threads(c), t, flops / t * 1e-9, t < *tbest ? "  *" : "");
+  if (t < *tbest) {
+    *tbest = t;
+    *best = *c;
+  }
+}
+
+/*
+ * Coordinate search from the default configuration: the loop order
+ * first, as it decides which operand is streamed, then each tile edge in
+ * turn over the powers of two from TUNE_MINTILE to TUNE_MAXTILE, and last
+ * the thread count. The full product of the choices would be several
+ * thousand runs, this is about fifty.
+ */
+void tune_search(tune_t *best, long long n, long long l, long long m, tune_run_t run, void *ctx) {
+  const double flops = 2.0 * n * l * m;
+  const long long dim[3] = {n, l, m};
+  double tbest = 1e300;
+  tune_t c;
+
+  tune_default(best);
+  best->ar = (int) (n < best->ar ? n : best->ar);
+  best->ac = (int) (l < best->ac ? l : best->ac);
+  best->bc = (int) (m < best->bc ? m : best->bc);
+  best->nthreads = omp_get_max_threads();
+  printf("%5s %5s %5s %6s %8s %10s %10s\n", "ar", "ac", "bc", "order", "threads", "time (s)", "GFLOP/s");
+
+  /* the first run also warms up the caches and the thread pool */
+  run(best, ctx);
+  for (int order = 0; order < TUNE_NORDER; ++order) {
+    c = *best;
+    c.order = order;
+    tune_try(&c, best, &tbest, flops, run, ctx);
+  }
+
+  for (int pass = 0; pass < TUNE_NPASS; ++pass) {
+    for (int e = 0; e < 3; ++e) {
+      for (long long tile = TUNE_MINTILE; tile <= TUNE_MAXTILE && tile <= dim[e]; tile *= 2) {
+        c = *best;
+        int *edge = e == 0 ? &c.ar : e == 1 ? &c.ac : &c.bc;
+        if (*edge == tile)
+          continue;
+        *edge = (int) tile;
+        tune_try(&c, best, &tbest, flops, run, ctx);
+      }
+    }
+  }
+
+  const int max = omp_get_max_threads();
+  for (int nt = 1; nt < max; nt *= 2) {
+    c = *best;
+    c.nthreads = nt;
+    tune_try(&c, best, &tbest, flops, run, ctx);
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+/*
+ * Tile sizes, loop order and thread count of the tiled matrix products,
+ * searched for on the current CPU and kept in a small text cache, one
+ * line per CPU model, code (c or cpp) and element type:
+ *
+ *   model name;code;type;ar ac bc order nthreads
+ *
+ * The cache is $MMP_TUNE_CACHE if set, else ~/.cache/mmp_tune.txt, and
+ * the directories on its path are made when it is saved.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* order of the loops inside a tile, outermost first */
+enum { TUNE_IJK, TUNE_IKJ, TUNE_JIK, TUNE_JKI, TUNE_KIJ, TUNE_KJI, TUNE_NORDER };
+
+typedef struct {
+  int ar;         /* rows of A in a tile */
+  int ac;         /* columns of A (rows of B) */
+  int bc;         /* columns of B */
+  int order;      /* TUNE_IJK ... */
+  int nthreads;   /* 0 for the OpenMP default */
+} tune_t;
+
+/* seconds one run of the kernel takes with the given configuration */
+typedef double (*tune_run_t)(const tune_t *t, void *ctx);
+
+void        tune_default(tune_t *t);
+const char *tune_order_name(int order);
+const char *tune_cpu(void);
+const char *tune_file(void);
+int         tune_load(const char *code, const char *type, tune_t *t);
+int         tune_save(const char *code, const char *type, const tune_t *t);
+int         tune_threads(const tune_t *t);
+void        tune_search(tune_t *best, long long n, long long l, long long m, tune_run_t run, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -5,14 +5,27 @@
 #include <string.h>
 #include <omp.h>
 #include <time.h>
+#include <float.h>
+#include <errno.h>
+
+#include "roofline.h"
+#include "autotune.h"
 
 #define SEED    918273
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+/* largest dimension of the leaves of mmp_recursive, and smallest one a
+   level of Strassen-Winograd is applied to in mmp_strassen */
+#define RECURSIVE_CUTOFF 128
+#define STRASSEN_CUTOFF  4096
 
 #ifdef USE_FLOAT
     typedef float  Float_t;
+    #define FLOAT_NAME "float"
 #else
     typedef double Float_t;
+    #define FLOAT_NAME "double"
 #endif
 
 
@@ -44,8 +57,23 @@ void mmp_parallel(const Float_t * restrict A, const Float_t * restrict B, Float_
   }   
 }
 
-void mmp_parallel_blocks(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C,
-                  const long long unsigned int N, const long long unsigned int L, const long long unsigned int M) {
+/* tile sizes, loop order and threads of mmp_parallel_blocks and
+   mmp_parallel_tiled: the defaults of autotune.h, or what the cache has
+   for this CPU and Float_t, read on the first call */
+const tune_t *mmp_tuning(void) {
+  static tune_t t;
+  static int loaded = 0;
+  if (!loaded) {
+    tune_default(&t);
+    tune_load("c", FLOAT_NAME, &t);
+    loaded = 1;
+  }
+  return &t;
+}
+
+void mmp_parallel_blocks_tuned(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C,
+                  const long long unsigned int N, const long long unsigned int L, const long long unsigned int M,
+                  const tune_t *t) {
 
   Float_t * D  = malloc(sizeof(Float_t) * M * L);
   #pragma omp parallel for collapse(2)
@@ -55,11 +83,12 @@ void mmp_parallel_blocks(const Float_t * restrict A, const Float_t * restrict B,
     }
   }
 
-  int Ar_blocksize = MIN(N,32);
-  int Bc_blocksize = MIN(M,32);
-  long long unsigned int Ar_N = N / Ar_blocksize + N % Ar_blocksize;
-  long long unsigned int Bc_N = M / Bc_blocksize + M % Bc_blocksize;
-  #pragma omp parallel for collapse(2)
+  const int nthreads = tune_threads(t);
+  const long long unsigned int Ar_blocksize = MIN(N, (long long unsigned int) t->ar);
+  const long long unsigned int Bc_blocksize = MIN(M, (long long unsigned int) t->bc);
+  const long long unsigned int Ar_N = (N + Ar_blocksize - 1) / Ar_blocksize;
+  const long long unsigned int Bc_N = (M + Bc_blocksize - 1) / Bc_blocksize;
+  #pragma omp parallel for collapse(2) num_threads(nthreads)
   for (long long unsigned int ii = 0; ii < Ar_N; ++ii) {
     for (long long unsigned int jj = 0; jj < Bc_N; ++jj) {
       long long unsigned int i_start = ii * Ar_blocksize;
@@ -83,59 +112,594 @@ void mmp_parallel_blocks(const Float_t * restrict A, const Float_t * restrict B,
   free(D);
 }
 
-void mmp_parallel_tiled(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C,
+void mmp_parallel_blocks(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C,
                   const long long unsigned int N, const long long unsigned int L, const long long unsigned int M) {
-  int Ar_blocksize = MIN(N,32);
-  int Ac_blocksize = MIN(L,32);
-  int Bc_blocksize = MIN(M,32);
-  long long unsigned int Ar_N = N / Ar_blocksize + N % Ar_blocksize;
-  long long unsigned int Ac_N = L / Ac_blocksize + L % Ac_blocksize;
-  long long unsigned int Bc_N = M / Bc_blocksize + M % Bc_blocksize;
-  #pragma omp parallel for collapse(2)
+  mmp_parallel_blocks_tuned(A, B, C, N, L, M, mmp_tuning());
+}
+
+/* the three loops over a tile, in the order given */
+#define TILE_LOOPS(X, Y, Z)                                                   \
+  for (long long unsigned int X = X##_start; X < X##_end; ++X)                \
+    for (long long unsigned int Y = Y##_start; Y < Y##_end; ++Y)              \
+      for (long long unsigned int Z = Z##_start; Z < Z##_end; ++Z)            \
+        C[i * M + j] += A[i * L + k] * B[k * M + j];
+
+void mmp_parallel_tiled_tuned(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C,
+                  const long long unsigned int N, const long long unsigned int L, const long long unsigned int M,
+                  const tune_t *t) {
+  const int nthreads = tune_threads(t);
+  const int order = t->order;
+  const long long unsigned int Ar_blocksize = MIN(N, (long long unsigned int) t->ar);
+  const long long unsigned int Ac_blocksize = MIN(L, (long long unsigned int) t->ac);
+  const long long unsigned int Bc_blocksize = MIN(M, (long long unsigned int) t->bc);
+  const long long unsigned int Ar_N = (N + Ar_blocksize - 1) / Ar_blocksize;
+  const long long unsigned int Ac_N = (L + Ac_blocksize - 1) / Ac_blocksize;
+  const long long unsigned int Bc_N = (M + Bc_blocksize - 1) / Bc_blocksize;
+  #pragma omp parallel for collapse(2) num_threads(nthreads)
   for (long long unsigned int ii = 0; ii < Ar_N; ++ii) {
     for (long long unsigned int jj = 0; jj < Bc_N; ++jj) {
       for (long long unsigned int kk = 0; kk < Ac_N; ++kk) {
-        long long unsigned int i_start = ii * Ar_blocksize;
-        long long unsigned int i_end = i_start + Ar_blocksize;
-        i_end = (i_end > N ? N : i_end);
-        for (long long unsigned int i = i_start; i < i_end; ++i) {
-          long long unsigned int j_start = jj * Bc_blocksize;
-          long long unsigned int j_end   = j_start + Bc_blocksize;
-          j_end = (j_end > M ? M : j_end);
-          for (long long unsigned int j = j_start; j < j_end; ++j) {
-            long long unsigned int k_start = kk * Ac_blocksize;
-            long long unsigned int k_end   = k_start + Ac_blocksize;
-            k_end = (k_end > L ? L : k_end);
-            for (long long unsigned int k = k_start; k < k_end; ++k) {
-              C[i * M + j] += A[i * L + k] * B[k * M +  j];
-	    }
-          }
+        const long long unsigned int i_start = ii * Ar_blocksize;
+        const long long unsigned int i_end   = MIN(i_start + Ar_blocksize, N);
+        const long long unsigned int j_start = jj * Bc_blocksize;
+        const long long unsigned int j_end   = MIN(j_start + Bc_blocksize, M);
+        const long long unsigned int k_start = kk * Ac_blocksize;
+        const long long unsigned int k_end   = MIN(k_start + Ac_blocksize, L);
+        switch (order) {
+        case TUNE_IKJ: TILE_LOOPS(i, k, j) break;
+        case TUNE_JIK: TILE_LOOPS(j, i, k) break;
+        case TUNE_JKI: TILE_LOOPS(j, k, i) break;
+        case TUNE_KIJ: TILE_LOOPS(k, i, j) break;
+        case TUNE_KJI: TILE_LOOPS(k, j, i) break;
+        default:       TILE_LOOPS(i, j, k) break;
         }
       }
     }
   }
 }
 
+void mmp_parallel_tiled(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C,
+                  const long long unsigned int N, const long long unsigned int L, const long long unsigned int M) {
+  mmp_parallel_tiled_tuned(A, B, C, N, L, M, mmp_tuning());
+}
+
+
+/* C = A * B + beta * C on an N x M block, with the rows of A, B and C
+   lda, ldb and ldc apart. The i-k-j order streams rows of B and C, so
+   the inner loop vectorises with no reduction */
+void mmp_leaf(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C,
+              const long long unsigned int N, const long long unsigned int L, const long long unsigned int M,
+              const long long unsigned int lda, const long long unsigned int ldb, const long long unsigned int ldc,
+              const Float_t beta) {
+  for (long long unsigned int i = 0; i < N; ++i) {
+    Float_t * restrict c = C + i * ldc;
+    #pragma omp simd
+    for (long long unsigned int j = 0; j < M; ++j)
+      c[j] = (beta == 0 ? 0 : beta * c[j]);
+    for (long long unsigned int k = 0; k < L; ++k) {
+      const Float_t a = A[i * lda + k];
+      const Float_t * restrict b = B + k * ldb;
+      #pragma omp simd
+      for (long long unsigned int j = 0; j < M; ++j)
+        c[j] += a * b[j];
+    }
+  }
+}
+
+/* Z = X + alpha * Y on N x M blocks, shared out as tasks; Z may be X or Y */
+void view_add(const long long unsigned int N, const long long unsigned int M,
+              const Float_t * X, const long long unsigned int ldx, const Float_t alpha,
+              const Float_t * Y, const long long unsigned int ldy,
+              Float_t * Z, const long long unsigned int ldz) {
+  #pragma omp taskloop grainsize(16)
+  for (long long unsigned int i = 0; i < N; ++i) {
+    #pragma omp simd
+    for (long long unsigned int j = 0; j < M; ++j)
+      Z[i * ldz + j] = X[i * ldx + j] + alpha * Y[i * ldy + j];
+  }
+}
+
+/* halve a dimension, keeping the first half a multiple of 16 if it can */
+long long unsigned int recursive_split(const long long unsigned int x) {
+  long long unsigned int h = x / 2 / 16 * 16;
+  return h ? h : x / 2;
+}
+
+void strassen_winograd(const Float_t * A, const Float_t * B, Float_t * C,
+                       const long long unsigned int N, const long long unsigned int L, const long long unsigned int M,
+                       const long long unsigned int lda, const long long unsigned int ldb, const long long unsigned int ldc,
+                       const Float_t beta, const long long unsigned int smin);
+
+/* C = A * B + beta * C on blocks, cache-obliviously: the largest of N, L
+   and M is halved until all are below RECURSIVE_CUTOFF. Halves of N or M
+   write to separate parts of C and are run as tasks, halves of L one
+   after the other. From smin up, if not 0, even sized blocks take a
+   level of Strassen-Winograd instead */
+void mmp_recursive_block(const Float_t * A, const Float_t * B, Float_t * C,
+                         const long long unsigned int N, const long long unsigned int L, const long long unsigned int M,
+                         const long long unsigned int lda, const long long unsigned int ldb, const long long unsigned int ldc,
+                         const Float_t beta, const long long unsigned int smin) {
+  if (smin > 0 && MIN(MIN(N, L), M) >= smin && N % 2 == 0 && L % 2 == 0 && M % 2 == 0) {
+    strassen_winograd(A, B, C, N, L, M, lda, ldb, ldc, beta, smin);
+  } else if (MAX(MAX(N, L), M) <= RECURSIVE_CUTOFF) {
+    mmp_leaf(A, B, C, N, L, M, lda, ldb, ldc, beta);
+  } else if (N >= M && N >= L) {
+    long long unsigned int h = recursive_split(N);
+    #pragma omp task
+    mmp_recursive_block(A, B, C, h, L, M, lda, ldb, ldc, beta, smin);
+    mmp_recursive_block(A + h * lda, B, C + h * ldc, N - h, L, M, lda, ldb, ldc, beta, smin);
+    #pragma omp taskwait
+  } else if (M >= L) {
+    long long unsigned int h = recursive_split(M);
+    #pragma omp task
+    mmp_recursive_block(A, B, C, N, L, h, lda, ldb, ldc, beta, smin);
+    mmp_recursive_block(A, B + h, C + h, N, L, M - h, lda, ldb, ldc, beta, smin);
+    #pragma omp taskwait
+  } else {
+    long long unsigned int h = recursive_split(L);
+    mmp_recursive_block(A, B, C, N, h, M, lda, ldb, ldc, beta, smin);
+    mmp_recursive_block(A + h, B + h * ldb, C, N, L - h, M, lda, ldb, ldc, 1, smin);
+  }
+}
+
+/* One level of Strassen-Winograd, 7 products of half size instead of 8,
+   in the schedule of Boyer, Dumas, Pernet and Zhou that uses the
+   quadrants of C as workspace and three temporaries. The rounding error
+   grows with each level */
+void strassen_winograd(const Float_t * A, const Float_t * B, Float_t * C,
+                       const long long unsigned int N, const long long unsigned int L, const long long unsigned int M,
+                       const long long unsigned int lda, const long long unsigned int ldb, const long long unsigned int ldc,
+                       const Float_t beta, const long long unsigned int smin) {
+  if (beta != 0) {
+    Float_t * W = malloc(sizeof(Float_t) * N * M);
+    strassen_winograd(A, B, W, N, L, M, lda, ldb, M, 0, smin);
+    view_add(N, M, W, M, beta, C, ldc, C, ldc);
+    free(W);
+    return;
+  }
+  const long long unsigned int n = N / 2, l = L / 2, m = M / 2;
+  const Float_t * A11 = A, * A12 = A + l, * A21 = A + n * lda, * A22 = A21 + l;
+  const Float_t * B11 = B, * B12 = B + m, * B21 = B + l * ldb, * B22 = B21 + m;
+  Float_t * C11 = C, * C12 = C + m, * C21 = C + n * ldc, * C22 = C21 + m;
+  Float_t * X = malloc(sizeof(Float_t) * n * l);
+  Float_t * Y = malloc(sizeof(Float_t) * l * m);
+  Float_t * Z = malloc(sizeof(Float_t) * n * m);
+
+  view_add(n, l, A11, lda, -1, A21, lda, X, l);                      /* S3 */
+  view_add(l, m, B22, ldb, -1, B12, ldb, Y, m);                      /* T3 */
+  mmp_recursive_block(X, Y, C21, n, l, m, l, m, ldc, 0, smin);       /* P7 */
+  view_add(n, l, A21, lda, 1, A22, lda, X, l);                       /* S1 */
+  view_add(l, m, B12, ldb, -1, B11, ldb, Y, m);                      /* T1 */
+  mmp_recursive_block(X, Y, C22, n, l, m, l, m, ldc, 0, smin);       /* P5 */
+  view_add(n, l, X, l, -1, A11, lda, X, l);                          /* S2 = S1 - A11 */
+  view_add(l, m, B22, ldb, -1, Y, m, Y, m);                          /* T2 = B22 - T1 */
+  mmp_recursive_block(X, Y, C12, n, l, m, l, m, ldc, 0, smin);       /* P6 */
+  view_add(n, l, A12, lda, -1, X, l, X, l);                          /* S4 = A12 - S2 */
+  view_add(l, m, Y, m, -1, B21, ldb, Y, m);                          /* T4 = T2 - B21 */
+  mmp_recursive_block(X, B22, C11, n, l, m, l, ldb, ldc, 0, smin);   /* P3 */
+  mmp_recursive_block(A11, B11, Z, n, l, m, lda, ldb, m, 0, smin);   /* P1 */
+  view_add(n, m, Z, m, 1, C12, ldc, C12, ldc);                       /* U2 = P1 + P6 */
+  view_add(n, m, C12, ldc, 1, C21, ldc, C21, ldc);                   /* U3 = U2 + P7 */
+  view_add(n, m, C12, ldc, 1, C22, ldc, C12, ldc);                   /* U4 = U2 + P5 */
+  view_add(n, m, C21, ldc, 1, C22, ldc, C22, ldc);                   /* C22 = U3 + P5 */
+  view_add(n, m, C12, ldc, 1, C11, ldc, C12, ldc);                   /* C12 = U4 + P3 */
+  mmp_recursive_block(A22, Y, C11, n, l, m, lda, m, ldc, 0, smin);   /* P4 */
+  view_add(n, m, C21, ldc, -1, C11, ldc, C21, ldc);                  /* C21 = U3 - P4 */
+  mmp_recursive_block(A12, B21, C11, n, l, m, lda, ldb, ldc, 0, smin); /* P2 */
+  view_add(n, m, Z, m, 1, C11, ldc, C11, ldc);                       /* C11 = P1 + P2 */
+
+  free(X); free(Y); free(Z);
+}
+
+void mmp_recursive_smin(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C,
+                        const long long unsigned int N, const long long unsigned int L, const long long unsigned int M,
+                        const long long unsigned int smin) {
+  #pragma omp parallel
+  #pragma omp single
+  mmp_recursive_block(A, B, C, N, L, M, L, M, M, 0, smin);
+}
+
+void mmp_recursive(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C,
+                   const long long unsigned int N, const long long unsigned int L, const long long unsigned int M) {
+  mmp_recursive_smin(A, B, C, N, L, M, 0);
+}
+
+void mmp_strassen(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C,
+                  const long long unsigned int N, const long long unsigned int L, const long long unsigned int M) {
+  mmp_recursive_smin(A, B, C, N, L, M, STRASSEN_CUTOFF);
+}
+
+
+
+typedef void (*mmp_t)(const Float_t * restrict, const Float_t * restrict, Float_t * restrict,
+                      const long long unsigned int, const long long unsigned int, const long long unsigned int);
+
+/* measure the roofs, run every kernel once and place it on the roofline */
+void roofline(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C,
+              const long long unsigned int N, const long long unsigned int L, const long long unsigned int M,
+              const int nthreads, const int counters) {
+  roof_t roof1, roofn;
+  roof_measure(&roof1, 1);
+  roof_print(&roof1);
+  if (nthreads > 1) {
+    roof_measure(&roofn, nthreads);
+    roof_print(&roofn);
+  } else {
+    roofn = roof1;
+  }
+  printf("\n");
+
+  const int size = sizeof(Float_t);
+  /* the tiled kernels keep C(i,j) in a register only when k is innermost */
+  const tune_t *tune = mmp_tuning();
+  const int block = (int) MIN(N, (long long unsigned int) tune->ar);
+  const int rmw = tune->order != TUNE_IJK && tune->order != TUNE_JIK;
+  const int tuned = tune_threads(tune);
+  roof_kernel_t k[] = {
+    {"mmp_serial",          ROOF_IJK,        0,     0,   1, 1,        N, L, M, size, 0, {0}},
+    {"mmp_parallel",        ROOF_IJK,        0,     0,   0, nthreads, N, L, M, size, 0, {0}},
+    {"mmp_parallel_blocks", ROOF_TRANSPOSED, block, 0,   0, tuned,    N, L, M, size, 0, {0}},
+    {"mmp_parallel_tiled",  ROOF_TILED,      block, rmw, 1, tuned,    N, L, M, size, 0, {0}},
+  };
+  const mmp_t f[] = {mmp_serial, mmp_parallel, mmp_parallel_blocks, mmp_parallel_tiled};
+  const int nk = sizeof(f) / sizeof(f[0]);
+
+  for (int i = 0; i < nk; ++i) {
+    memset(C, 0, sizeof(Float_t) * N * M);
+    int on = counters && roof_counters_start() == 0;
+    if (counters && !on && i == 0)
+      printf("perf_event_open failed, no hardware counters (see /proc/sys/kernel/perf_event_paranoid)\n\n");
+    double t = omp_get_wtime();
+    f[i](A, B, C, N, L, M);
+    k[i].time = omp_get_wtime() - t;
+    if (on) roof_counters_stop(&k[i].count);
+  }
+  roof_report(&roof1, &roofn, k, nk);
+}
+
+/* largest difference between A and the reference B, relative to the
+   largest element of B */
+double relerr(const Float_t * restrict A, const Float_t * restrict B, const long long unsigned int N, const long long unsigned int M) {
+  double err = 0, big = 0;
+  #pragma omp parallel for reduction(max:err, big)
+  for (long long unsigned int ii = 0; ii < N * M; ++ii) {
+    err = MAX(err, fabs(A[ii] - B[ii]));
+    big = MAX(big, fabs(B[ii]));
+  }
+  return big > 0 ? err / big : err;
+}
+
+/* time mmp_recursive and Strassen-Winograd with one level and more, and
+   report how far they are from mmp_serial */
+void accuracy(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C0, Float_t * restrict C,
+              const long long unsigned int N, const long long unsigned int L, const long long unsigned int M) {
+  const double flops = 2.0 * N * L * M;
+  memset(C0, 0, sizeof(Float_t) * N * M);
+  double t = omp_get_wtime();
+  mmp_serial(A, B, C0, N, L, M);
+  t = omp_get_wtime() - t;
+  printf("%-28s %10s %10s %14s\n", "kernel", "time (s)", "GFLOP/s", "rel err");
+  printf("%-28s %10.4f %10.2f %14s\n", "mmp_serial", t, flops / t * 1e-9, "-");
+
+  t = omp_get_wtime();
+  mmp_recursive(A, B, C, N, L, M);
+  t = omp_get_wtime() - t;
+  printf("%-28s %10.4f %10.2f %14.3e\n", "mmp_recursive", t, flops / t * 1e-9, relerr(C, C0, N, M));
+
+  long long unsigned int smin = MIN(MIN(N, L), M);
+  for (int level = 1; level <= 3 && smin >= 64; ++level, smin /= 2) {
+    char name[64];
+    snprintf(name, sizeof(name), "Strassen-Winograd >= %llu", smin);
+    t = omp_get_wtime();
+    mmp_recursive_smin(A, B, C, N, L, M, smin);
+    t = omp_get_wtime() - t;
+    printf("%-28s %10.4f %10.2f %14.3e\n", name, t, flops / t * 1e-9, relerr(C, C0, N, M));
+  }
+}
+
+/* problem the tuner times, as the full one would take minutes per pass */
+#define TUNE_SIZE 512
+
+typedef struct {
+  const Float_t *A, *B;
+  Float_t *C;
+  long long unsigned int N, L, M;
+} tune_ctx_t;
+
+static double tune_run(const tune_t *t, void *ctx) {
+  const tune_ctx_t *p = ctx;
+  memset(p->C, 0, sizeof(Float_t) * p->N * p->M);
+  double s = omp_get_wtime();
+  mmp_parallel_tiled_tuned(p->A, p->B, p->C, p->N, p->L, p->M, t);
+  return omp_get_wtime() - s;
+}
+
+/* search the tiles, loop order and threads of mmp_parallel_tiled on a
+   TUNE_SIZE problem cut from A and B, and keep the best in the cache */
+void tune(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C,
+          const long long unsigned int N, const long long unsigned int L, const long long unsigned int M) {
+  tune_ctx_t ctx = {A, B, C, MIN(N, TUNE_SIZE), MIN(L, TUNE_SIZE), MIN(M, TUNE_SIZE)};
+  tune_t best;
+  printf("tuning mmp_parallel_tiled, %s, %llu x %llu x %llu on %s\n\n",
+         FLOAT_NAME, ctx.N, ctx.L, ctx.M, tune_cpu());
+  tune_search(&best, ctx.N, ctx.L, ctx.M, tune_run, &ctx);
+  printf("\nbest: %d x %d x %d tiles, %s order, %d threads\n",
+         best.ar, best.ac, best.bc, tune_order_name(best.order), best.nthreads);
+  if (tune_save("c", FLOAT_NAME, &best) == 0)
+    printf("saved in %s\n", tune_file());
+  else
+    fprintf(stderr, "could not write %s: %s; the result was not saved\n", tune_file(), strerror(errno));
+}
+
+/* default sweep: square, non-square and sizes off the multiples of 32,
+   each N x L x M for C(N x M) = A(N x L) * B(L x M) */
+#define BENCH_SIZES "256,512,1000,1024,1024x256x2048,333x777x555,2000x64x2000,64x2000x64"
+#define BENCH_CSV   "bench.csv"
+#define BENCH_MAXTHREADS 64
+#define BENCH_MAXREPS    1000
+
+#ifndef BUILD_FLAGS
+#define BUILD_FLAGS ""
+#endif
+
+typedef struct {
+  int warmup, reps;
+  const char *sizes;
+  const char *kernels;   /* comma separated names, NULL for all */
+  const char *threads;   /* comma separated counts, NULL for 1, 2, 4 ... */
+  const char *csv;
+} bench_opt_t;
+
+/* the tiled kernels with the tuned tiles but the thread count of the
+   sweep, not the tuned one */
+static tune_t bench_tune;
+
+static void bench_blocks(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C,
+                         const long long unsigned int N, const long long unsigned int L, const long long unsigned int M) {
+  mmp_parallel_blocks_tuned(A, B, C, N, L, M, &bench_tune);
+}
+
+static void bench_tiled(const Float_t * restrict A, const Float_t * restrict B, Float_t * restrict C,
+                        const long long unsigned int N, const long long unsigned int L, const long long unsigned int M) {
+  mmp_parallel_tiled_tuned(A, B, C, N, L, M, &bench_tune);
+}
+
+/* C = A * B accumulated in double, whatever Float_t is, as the reference */
+static void bench_reference(const Float_t * restrict A, const Float_t * restrict B, double * restrict C,
+                            const long long unsigned int N, const long long unsigned int L, const long long unsigned int M) {
+  #pragma omp parallel for
+  for (long long unsigned int i = 0; i < N; ++i) {
+    for (long long unsigned int j = 0; j < M; ++j)
+      C[i * M + j] = 0;
+    for (long long unsigned int k = 0; k < L; ++k) {
+      const double a = A[i * L + k];
+      #pragma omp simd
+      for (long long unsigned int j = 0; j < M; ++j)
+        C[i * M + j] += a * B[k * M + j];
+    }
+  }
+}
+
+/* largest difference between C and the reference, relative to the
+   largest element of the reference */
+static double bench_relerr(const Float_t * restrict C, const double * restrict R,
+                           const long long unsigned int N, const long long unsigned int M) {
+  double err = 0, big = 0;
+  #pragma omp parallel for reduction(max:err, big)
+  for (long long unsigned int ii = 0; ii < N * M; ++ii) {
+    err = MAX(err, fabs(C[ii] - R[ii]));
+    big = MAX(big, fabs(R[ii]));
+  }
+  return big > 0 ? err / big : err;
+}
 
+static int bench_cmp(const void *a, const void *b) {
+  const double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
 
-int check(const Float_t * restrict A, const Float_t * restrict B, const long long unsigned int N, const long long unsigned int M) {
-  int errs = 0;
+/* name is in the comma separated list, or the list is NULL */
+static int bench_selected(const char *list, const char *name) {
+  const size_t len = strlen(name);
+  if (list == NULL)
+    return 1;
+  for (const char *s = list; s != NULL; s = strchr(s, ',')) {
+    if (*s == ',') ++s;
+    if (strncmp(s, name, len) == 0 && (s[len] == ',' || s[len] == '\0'))
+      return 1;
+  }
+  return 0;
+}
+
+/*
+ * Every kernel on every size and thread count: opt->warmup runs that are
+ * not timed, then opt->reps timed ones, each on a zeroed C. The median
+ * and the 95th percentile (nearest rank) of the times are reported, with
+ * GFLOP/s from the median, and the last result is checked against a
+ * double reference to a relative tolerance of 4 L epsilon, the bound of
+ * a dot product of length L. mmp_serial only runs on one thread. One
+ * line per run is appended to opt->csv, with the header if it is new;
+ * the compiler and flags columns tell builds apart.
+ */
+int bench(const bench_opt_t *opt) {
+  static const struct { const char *name; mmp_t f; int serial; } kernels[] = {
+    {"mmp_serial",          mmp_serial,    1},
+    {"mmp_parallel",        mmp_parallel,  0},
+    {"mmp_parallel_blocks", bench_blocks,  0},
+    {"mmp_parallel_tiled",  bench_tiled,   0},
+    {"mmp_recursive",       mmp_recursive, 0},
+  };
+  const int nk = sizeof(kernels) / sizeof(kernels[0]);
 #ifdef USE_FLOAT
-  const Float_t tol = 1e-2;
+  const double tol_eps = FLT_EPSILON;
 #else
-  const Float_t tol = 1e-5;
+  const double tol_eps = DBL_EPSILON;
 #endif
-  long long unsigned int Dim = N * M;
-  #pragma omp parallel for reduction(+:errs) 
-  for ( long long unsigned int ii = 0; ii < Dim; ++ii) {
-    if ( fabs( A[ii] - B[ii] ) > tol )
-      ++errs;
+  int threads[BENCH_MAXTHREADS], nthreads = 0, fails = 0;
+  const int max = omp_get_max_threads();
+  if (opt->threads != NULL) {
+    for (const char *s = opt->threads; s != NULL && nthreads < BENCH_MAXTHREADS; s = strchr(s, ',')) {
+      if (*s == ',') ++s;
+      if ((threads[nthreads] = atoi(s)) > 0) ++nthreads;
+    }
+  } else {
+    for (int nt = 1; nt < max && nthreads < BENCH_MAXTHREADS - 1; nt *= 2)
+      threads[nthreads++] = nt;
+    threads[nthreads++] = max;
+  }
+  if (opt->reps < 1 || opt->reps > BENCH_MAXREPS || opt->warmup < 0 || nthreads == 0) {
+    fprintf(stderr, "bench: bad repetitions, warm-ups or threads\n");
+    return 1;
   }
-  return errs;
+
+  FILE *csv = fopen(opt->csv, "a");
+  if (csv == NULL) {
+    fprintf(stderr, "bench: cannot open %s\n", opt->csv);
+    return 1;
+  }
+  if (ftell(csv) == 0)
+    fprintf(csv, "code,compiler,flags,type,kernel,n,l,m,threads,warmup,reps,median_s,p95_s,min_s,gflops,relerr,ok\n");
+
+  bench_tune = *mmp_tuning();
+  bench_tune.nthreads = 0;
+  printf("%-20s %-16s %7s %10s %10s %10s %10s %4s\n",
+         "kernel", "N x L x M", "threads", "median (s)", "p95 (s)", "GFLOP/s", "rel err", "ok");
+
+  double times[BENCH_MAXREPS];
+  for (const char *s = opt->sizes; s != NULL; s = strchr(s, ',')) {
+    long long unsigned int N, L, M;
+    if (*s == ',') ++s;
+    int got = sscanf(s, "%llux%llux%llu", &N, &L, &M);
+    if (got == 1) L = M = N;
+    if ((got != 1 && got != 3) || N == 0 || L == 0 || M == 0) {
+      fprintf(stderr, "bench: bad size at \"%s\"\n", s);
+      fclose(csv);
+      return 1;
+    }
+
+    Float_t * A = malloc(sizeof(Float_t) * N * L);
+    Float_t * B = malloc(sizeof(Float_t) * L * M);
+    Float_t * C = malloc(sizeof(Float_t) * N * M);
+    double  * R = malloc(sizeof(double) * N * M);
+    unsigned short seed[3] = {(unsigned short) SEED, (unsigned short) (SEED + 1), (unsigned short) (SEED + 2)};
+    for (long long unsigned int i = 0; i < N * L; ++i)
+      A[i] = erand48(seed);
+    for (long long unsigned int i = 0; i < L * M; ++i)
+      B[i] = erand48(seed);
+    bench_reference(A, B, R, N, L, M);
+    const double flops = 2.0 * N * L * M;
+    const double tol = 4.0 * L * tol_eps;
+    char shape[64];
+    snprintf(shape, sizeof(shape), "%llux%llux%llu", N, L, M);
+
+    for (int k = 0; k < nk; ++k) {
+      if (!bench_selected(opt->kernels, kernels[k].name))
+        continue;
+      for (int t = 0; t < (kernels[k].serial ? 1 : nthreads); ++t) {
+        const int nt = kernels[k].serial ? 1 : threads[t];
+        omp_set_num_threads(nt);
+        for (int r = 0; r < opt->warmup + opt->reps; ++r) {
+          memset(C, 0, sizeof(Float_t) * N * M);
+          double t0 = omp_get_wtime();
+          kernels[k].f(A, B, C, N, L, M);
+          if (r >= opt->warmup)
+            times[r - opt->warmup] = omp_get_wtime() - t0;
+        }
+        omp_set_num_threads(max);
+
+        qsort(times, opt->reps, sizeof(double), bench_cmp);
+        const int h = opt->reps / 2;
+        const double median = opt->reps % 2 ? times[h] : 0.5 * (times[h - 1] + times[h]);
+        const double p95 = times[(int) ceil(0.95 * opt->reps) - 1];
+        const double err = bench_relerr(C, R, N, M);
+        const int ok = err <= tol;
+        fails += !ok;
+        printf("%-20s %-16s %7d %10.4f %10.4f %10.2f %10.2e %4s\n", kernels[k].name, shape, nt,
+               median, p95, flops / median * 1e-9, err, ok ? "yes" : "NO");
+        fprintf(csv, "c,%s,%s,%s,%s,%llu,%llu,%llu,%d,%d,%d,%.6e,%.6e,%.6e,%.4f,%.3e,%d\n",
+                __VERSION__, BUILD_FLAGS, FLOAT_NAME, kernels[k].name, N, L, M, nt,
+                opt->warmup, opt->reps, median, p95, times[0], flops / median * 1e-9, err, ok);
+        fflush(csv);
+      }
+    }
+    free(A); free(B); free(C); free(R);
+  }
+  fclose(csv);
+  if (fails)
+    fprintf(stderr, "bench: %d result(s) off the reference by more than the tolerance\n", fails);
+  return fails != 0;
 }
 
 
-int main () {
+static void usage(FILE *f, const char *prog) {
+  fprintf(f, "usage: %s [-h] [-t] [-r] [-p] [-a] [-s SIZES] [-k KERNELS] [-T THREADS] [-w N] [-n N] [-o FILE]\n"
+             "  -h  print this help\n"
+             "  -t  tune the tiles, loop order and threads of the tiled kernels\n"
+             "  -r  measure the roofline and place the kernels on it\n"
+             "  -p  as -r, also reading the hardware counters\n"
+             "  -a  error of mmp_recursive and Strassen-Winograd against mmp_serial\n"
+             "without -t, -r, -p or -a the kernels are benchmarked:\n"
+             "  -s  sizes, N or NxLxM separated by commas, default " BENCH_SIZES "\n"
+             "  -k  kernels separated by commas, default all\n"
+             "  -T  thread counts separated by commas, default 1, 2, 4 ... OMP_NUM_THREADS\n"
+             "  -w  untimed warm-up runs, default 1\n"
+             "  -n  timed runs, default 5\n"
+             "  -o  CSV file the results are appended to, default " BENCH_CSV "\n", prog);
+}
+
+int main (int argc, char **argv) {
+  int roof = 0, counters = 0, acc = 0, autotune = 0, opt;
+  bench_opt_t bopt = {1, 5, BENCH_SIZES, NULL, NULL, BENCH_CSV};
+  while ((opt = getopt(argc, argv, "hrpats:k:T:w:n:o:")) != -1) {
+    switch (opt) {
+    case 'h':
+      usage(stdout, argv[0]);
+      return 0;
+    case 't':
+      autotune = 1;
+      break;
+    case 'a':
+      acc = 1;
+      break;
+    case 'r':
+      roof = 1;
+      break;
+    case 'p':
+      roof = 1;
+      counters = 1;
+      break;
+    case 's':
+      bopt.sizes = optarg;
+      break;
+    case 'k':
+      bopt.kernels = optarg;
+      break;
+    case 'T':
+      bopt.threads = optarg;
+      break;
+    case 'w':
+      bopt.warmup = atoi(optarg);
+      break;
+    case 'n':
+      bopt.reps = atoi(optarg);
+      break;
+    case 'o':
+      bopt.csv = optarg;
+      break;
+    default:
+      usage(stderr, argv[0]);
+      return 1;
+    }
+  }
+
+  int nthreads;
+  #pragma omp parallel 
+  #pragma omp master
+    nthreads = omp_get_num_threads();   ; 
+  printf("Number of Threads: %d\n", nthreads);
+  if (!(autotune || roof || acc))
+    return bench(&bopt);
+
   const long long unsigned int n = 1024;
   const long long unsigned int m = 1024;
   const long long unsigned int l = 1024;
@@ -143,13 +707,6 @@ int main () {
   Float_t * b  = malloc(sizeof(Float_t) * l * m);  
   Float_t * c0 = malloc(sizeof(Float_t) * n * m); 
   Float_t * c1 = malloc(sizeof(Float_t) * n * m); 
-  Float_t * c2 = malloc(sizeof(Float_t) * n * m); 
-  Float_t * c3 = malloc(sizeof(Float_t) * n * m); 
-  int nthreads;
-  #pragma omp parallel 
-  #pragma omp master
-    nthreads = omp_get_num_threads();   ; 
-  printf("Number of Threads: %d\n", nthreads);
   #pragma omp parallel
   {
     int myid = omp_get_thread_num();
@@ -165,42 +722,13 @@ int main () {
     for(long long unsigned int i = 0; i < n * m; i++) {
       c0[i] = 0.;
       c1[i] = 0.;
-      c2[i] = 0.;
-      c3[i] = 0.;
     }
   }
-  /*
-  double t0 = omp_get_wtime();
-  mmp_serial(a,b,c0,n,l,m);
-  t0 = omp_get_wtime() - t0;
-
-  double t1 = omp_get_wtime();
-  mmp_parallel(a,b,c1,n,l,m);
-  t1 = omp_get_wtime() - t1;
-  
-  double t2 = omp_get_wtime();
-  mmp_parallel_blocks(a,b,c2,n,l,m);
-  t2 = omp_get_wtime() - t2;
-*/
-  double t3 = omp_get_wtime();
-  mmp_parallel_tiled(a,b,c3,n,l,m);
-  t3 = omp_get_wtime() - t3;
-  /*
-  int v01 = check(c0, c1, n, m);
-  int v02 = check(c0, c2, n, m);
-  int v03 = check(c0, c3, n, m);
-  int v12 = check(c1, c2, n, m);
-  int v13 = check(c1, c3, n, m);
-  int v23 = check(c2, c3, n, m);
-  printf("t0 == %f\nt1 == %f\nt2 == %f\nt3 == %f\n", t0, t1, t2, t3);
-  printf("c0 == c1? %s\n", v01? "false" : "true");
-  printf("c0 == c2? %s\n", v02? "false" : "true");
-  printf("c0 == c3? %s\n", v03? "false" : "true");
-  printf("c1 == c2? %s\n", v12? "false" : "true");
-  printf("c1 == c3? %s\n", v13? "false" : "true");
-  printf("c2 == c3? %s\n", v23? "false" : "true");
-  */
-  free(a); free(b); free(c0); free(c1); free(c2); free(c3);
+  if (autotune) tune(a, b, c0, n, l, m);
+  if (autotune && (roof || acc)) printf("\n");
+  if (roof) roofline(a, b, c0, n, l, m, nthreads, counters);
+  if (roof && acc) printf("\n");
+  if (acc) accuracy(a, b, c0, c1, n, l, m);
+  free(a); free(b); free(c0); free(c1);
   return 0;
 }
-
@@ -3,6 +3,20 @@
 #include "mtl.hpp"
 #include <omp.h>
 #include <chrono>
+#include <functional>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <tuple>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+#include "roofline.h"
+#include "autotune.h"
 
 double wtime() {
 #ifdef _OPENMP
@@ -20,8 +34,386 @@ inline std::string strbool(const bool b) {
   return (b? "true" : "false");
 }
 
-int main() {
-  
+// measure the roofs, run every kernel once and place it on the roofline
+template<typename T>
+void roofline(const mtl::Matrix<T>& a, const mtl::Matrix<T>& b, const int nthreads, const bool counters) {
+  roof_t roof1, roofn;
+  roof_measure(&roof1, 1);
+  roof_print(&roof1);
+  if (nthreads > 1) {
+    roof_measure(&roofn, nthreads);
+    roof_print(&roofn);
+  } else {
+    roofn = roof1;
+  }
+  std::cout << "\n";
+
+  const long long n = a.num_rows(), l = a.num_cols(), m = b.num_cols();
+  const int size = sizeof(T);
+  // the tiled kernels run with the tuned tiles and threads
+  const tune_t& tune = mtl::tuning<T>();
+  const int block = std::min(static_cast<int>(n), tune.ar);
+  const int tuned = tune_threads(&tune);
+  using blk = mtl::gemm_blocking<T>;
+  const int gemm = 2 * blk::MR * blk::NR / (blk::MR + blk::NR);
+  // serial and tiled update C(i,j) in the innermost loop, which the
+  // compiler cannot keep in a register as it may alias A or B
+  roof_kernel_t k[] = {
+    {"mmp_serial",          ROOF_IJK,        0,     1, 1, 1,        n, l, m, size, 0, {}},
+    {"mmp_parallel",        ROOF_IJK,        0,     0, 0, nthreads, n, l, m, size, 0, {}},
+    {"mmp_parallel_blocks", ROOF_TRANSPOSED, block, 0, 0, tuned,    n, l, m, size, 0, {}},
+    {"mmp_parallel_tiled",  ROOF_TILED,      block, 1, 1, tuned,    n, l, m, size, 0, {}},
+    {"mmp_gemm",            ROOF_PACKED,     gemm,  0, 0, nthreads, n, l, m, size, 0, {}},
+  };
+  const std::function<mtl::Matrix<T>()> f[] = {
+    [&] { return mtl::mmp_serial(a, b); },
+    [&] { return mtl::mmp_parallel(a, b); },
+    [&] { return mtl::mmp_parallel_blocks(a, b); },
+    [&] { return mtl::mmp_parallel_tiled(a, b); },
+    [&] { return mtl::mmp_gemm(a, b); },
+  };
+
+  for (std::size_t i = 0; i < std::size(f); ++i) {
+    const bool on = counters && roof_counters_start() == 0;
+    if (counters && !on && i == 0)
+      std::cout << "perf_event_open failed, no hardware counters (see /proc/sys/kernel/perf_event_paranoid)\n\n";
+    auto t = wtime();
+    auto c = f[i]();
+    k[i].time = wtime() - t;
+    if (on) roof_counters_stop(&k[i].count);
+  }
+  roof_report(&roof1, &roofn, k, std::size(k));
+}
+
+// largest difference between a and the reference b, relative to the
+// largest element of b
+template<typename T>
+double relerr(const mtl::Matrix<T>& a, const mtl::Matrix<T>& b) {
+  double err{0}, big{0};
+  #pragma omp parallel for collapse(2) reduction(max:err, big)
+  for (std::size_t r = 0; r < b.num_rows(); ++r) {
+    for (std::size_t c = 0; c < b.num_cols(); ++c) {
+      err = std::max(err, static_cast<double>(std::abs(a(r,c) - b(r,c))));
+      big = std::max(big, static_cast<double>(std::abs(b(r,c))));
+    }
+  }
+  return big > 0 ? err / big : err;
+}
+
+// time mmp_recursive and Strassen-Winograd with one level and more, and
+// report how far they are from mmp_serial
+template<typename T>
+void accuracy(const mtl::Matrix<T>& a, const mtl::Matrix<T>& b) {
+  const double flops = 2.0 * a.num_rows() * a.num_cols() * b.num_cols();
+  auto line = [&](const std::string& name, double t, const std::string& err) {
+    std::printf("%-28s %10.4f %10.2f %14s\n", name.c_str(), t, flops / t * 1e-9, err.c_str());
+  };
+  auto sci = [](double x) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.3e", x);
+    return std::string{buf};
+  };
+  std::printf("%-28s %10s %10s %14s\n", "kernel", "time (s)", "GFLOP/s", "rel err");
+  auto t = wtime();
+  const auto c0 = mtl::mmp_serial(a, b);
+  line("mmp_serial", wtime() - t, "-");
+
+  t = wtime();
+  auto c = mtl::mmp_recursive(a, b);
+  t = wtime() - t;
+  line("mmp_recursive", t, sci(relerr(c, c0)));
+
+  auto smin = std::min({a.num_rows(), a.num_cols(), b.num_cols()});
+  for (int level = 1; level <= 3 && smin >= 64; ++level, smin /= 2) {
+    t = wtime();
+    c = mtl::mmp_recursive(a, b, smin);
+    t = wtime() - t;
+    line("Strassen-Winograd >= " + std::to_string(smin), t, sci(relerr(c, c0)));
+  }
+}
+
+// problem the tuner times, as the full one would take minutes per pass
+constexpr std::size_t tune_size{512};
+
+// search the tiles, loop order and threads of mmp_parallel_tiled on a
+// tune_size problem cut from a and b, and keep the best in the cache
+template<typename T>
+void tune(const mtl::Matrix<T>& a, const mtl::Matrix<T>& b) {
+  const auto n = std::min(a.num_rows(), tune_size);
+  const auto l = std::min(a.num_cols(), tune_size);
+  const auto m = std::min(b.num_cols(), tune_size);
+  mtl::Matrix<T> ta{n, l}, tb{l, m};
+  for (std::size_t r = 0; r < n; ++r)
+    for (std::size_t c = 0; c < l; ++c)
+      ta(r,c) = a(r,c);
+  for (std::size_t r = 0; r < l; ++r)
+    for (std::size_t c = 0; c < m; ++c)
+      tb(r,c) = b(r,c);
+
+  std::cout << "tuning mmp_parallel_tiled, " << mtl::tune_type<T>() << ", " << n << " x " << l << " x " << m
+            << " on " << tune_cpu() << "\n\n";
+  auto run = [](const tune_t* t, void* ctx) {
+    const auto& [pa, pb] = *static_cast<std::pair<const mtl::Matrix<T>*, const mtl::Matrix<T>*>*>(ctx);
+    auto s = wtime();
+    auto c = mtl::mmp_parallel_tiled(*pa, *pb, *t);
+    return wtime() - s;
+  };
+  std::pair<const mtl::Matrix<T>*, const mtl::Matrix<T>*> ctx{&ta, &tb};
+  tune_t best;
+  tune_search(&best, n, l, m, run, &ctx);
+  std::cout << "\nbest: " << best.ar << " x " << best.ac << " x " << best.bc << " tiles, "
+            << tune_order_name(best.order) << " order, " << best.nthreads << " threads\n";
+  if (tune_save("cpp", mtl::tune_type<T>(), &best) == 0)
+    std::cout << "saved in " << tune_file() << "\n";
+  else
+    std::cerr << "could not write " << tune_file() << ": " << std::strerror(errno) << "; the result was not saved\n";
+}
+
+
+// default sweep: square, non-square and sizes off the multiples of 32,
+// each N x L x M for C(N x M) = A(N x L) * B(L x M)
+constexpr auto bench_sizes{"256,512,1000,1024,1024x256x2048,333x777x555,2000x64x2000,64x2000x64"};
+constexpr auto bench_csv{"bench.csv"};
+
+#ifndef BUILD_FLAGS
+#define BUILD_FLAGS ""
+#endif
+
+struct bench_opt {
+  int warmup{1}, reps{5};
+  std::string sizes{bench_sizes};
+  std::string kernels;    // comma separated names, empty for all
+  std::string threads;    // comma separated counts, empty for 1, 2, 4 ...
+  std::string types{"double,float"};
+  std::string csv{bench_csv};
+};
+
+std::vector<std::string> split(const std::string& list) {
+  std::vector<std::string> v;
+  std::size_t b = 0;
+  while (b <= list.size()) {
+    auto e = std::min(list.find(',', b), list.size());
+    if (e > b) v.push_back(list.substr(b, e - b));
+    b = e + 1;
+  }
+  return v;
+}
+
+// every kernel on every size and thread count for one element type,
+// see bench below; returns the number of results off the reference
+template<typename T>
+int bench_type(const bench_opt& opt, const std::vector<int>& threads, std::FILE* csv) {
+  // the tiled kernels with the tuned tiles but the thread count of the sweep
+  tune_t tune = mtl::tuning<T>();
+  tune.nthreads = 0;
+  using mmp = std::function<mtl::Matrix<T>(const mtl::Matrix<T>&, const mtl::Matrix<T>&)>;
+  const std::tuple<std::string, mmp, bool> kernels[] = {
+    {"mmp_serial",          [](auto& a, auto& b) { return mtl::mmp_serial(a, b); },           true},
+    {"mmp_parallel",        [](auto& a, auto& b) { return mtl::mmp_parallel(a, b); },         false},
+    {"mmp_parallel_blocks", [&](auto& a, auto& b) { return mtl::mmp_parallel_blocks(a, b, tune); }, false},
+    {"mmp_parallel_tiled",  [&](auto& a, auto& b) { return mtl::mmp_parallel_tiled(a, b, tune); },  false},
+    {"mmp_gemm",            [](auto& a, auto& b) { return mtl::mmp_gemm(a, b); },             false},
+    {"mmp_recursive",       [](auto& a, auto& b) { return mtl::mmp_recursive(a, b); },        false},
+  };
+  const auto selected = split(opt.kernels);
+  const int max = omp_get_max_threads();
+  int fails = 0;
+
+  for (const auto& size : split(opt.sizes)) {
+    std::size_t n, l, m;
+    const int got = std::sscanf(size.c_str(), "%zux%zux%zu", &n, &l, &m);
+    if (got == 1) l = m = n;
+    if ((got != 1 && got != 3) || n == 0 || l == 0 || m == 0)
+      throw std::invalid_argument{"bad size " + size};
+
+    mtl::Matrix<T> a{n, l}, b{l, m};
+    std::mt19937 generator(918273);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    for (std::size_t r = 0; r < n; ++r)
+      for (std::size_t c = 0; c < l; ++c)
+        a(r,c) = uniform(generator);
+    for (std::size_t r = 0; r < l; ++r)
+      for (std::size_t c = 0; c < m; ++c)
+        b(r,c) = uniform(generator);
+
+    // C = A * B accumulated in double, whatever T is, as the reference
+    std::vector<double> ref(n * m, 0.0);
+    #pragma omp parallel for
+    for (std::size_t i = 0; i < n; ++i)
+      for (std::size_t k = 0; k < l; ++k) {
+        const double aik = a(i,k);
+        #pragma omp simd
+        for (std::size_t j = 0; j < m; ++j)
+          ref[i * m + j] += aik * b(k,j);
+      }
+    const double big = *std::max_element(ref.begin(), ref.end());
+    const double flops = 2.0 * n * l * m;
+    const double tol = 4.0 * l * std::numeric_limits<T>::epsilon();
+    const auto shape = std::to_string(n) + "x" + std::to_string(l) + "x" + std::to_string(m);
+
+    for (const auto& [name, f, serial] : kernels) {
+      if (!selected.empty() && std::find(selected.begin(), selected.end(), name) == selected.end())
+        continue;
+      for (std::size_t t = 0; t < (serial ? 1 : threads.size()); ++t) {
+        const int nt = serial ? 1 : threads[t];
+        std::vector<double> times;
+        mtl::Matrix<T> c{1, 1};
+        omp_set_num_threads(nt);
+        for (int r = 0; r < opt.warmup + opt.reps; ++r) {
+          auto t0 = wtime();
+          c = f(a, b);
+          if (r >= opt.warmup) times.push_back(wtime() - t0);
+        }
+        omp_set_num_threads(max);
+
+        std::sort(times.begin(), times.end());
+        const std::size_t h = times.size() / 2;
+        const double median = times.size() % 2 ? times[h] : 0.5 * (times[h - 1] + times[h]);
+        const double p95 = times[static_cast<std::size_t>(std::ceil(0.95 * times.size())) - 1];
+        double err{0};
+        #pragma omp parallel for collapse(2) reduction(max:err)
+        for (std::size_t i = 0; i < n; ++i)
+          for (std::size_t j = 0; j < m; ++j)
+            err = std::max(err, std::abs(c(i,j) - ref[i * m + j]));
+        err = big > 0 ? err / big : err;
+        const bool ok = err <= tol;
+        fails += !ok;
+        std::printf("%-20s %-6s %-16s %7d %10.4f %10.4f %10.2f %10.2e %4s\n", name.c_str(), mtl::tune_type<T>(),
+                    shape.c_str(), nt, median, p95, flops / median * 1e-9, err, ok ? "yes" : "NO");
+        std::fprintf(csv, "cpp,%s,%s,%s,%s,%zu,%zu,%zu,%d,%d,%d,%.6e,%.6e,%.6e,%.4f,%.3e,%d\n",
+                     __VERSION__, BUILD_FLAGS, mtl::tune_type<T>(), name.c_str(), n, l, m, nt,
+                     opt.warmup, opt.reps, median, p95, times.front(), flops / median * 1e-9, err, ok);
+        std::fflush(csv);
+      }
+    }
+  }
+  return fails;
+}
+
+// every kernel on every size, type and thread count: opt.warmup runs
+// that are not timed, then opt.reps timed ones, reported as the median
+// and the 95th percentile (nearest rank), with GFLOP/s from the median.
+// The result is checked against a double reference to a relative
+// tolerance of 4 L epsilon, and one line per run is appended to opt.csv
+// in the same columns as main_c.x
+int bench(const bench_opt& opt) {
+  std::vector<int> threads;
+  for (const auto& t : split(opt.threads))
+    if (std::stoi(t) > 0) threads.push_back(std::stoi(t));
+  if (opt.threads.empty()) {
+    const int max = omp_get_max_threads();
+    for (int nt = 1; nt < max; nt *= 2) threads.push_back(nt);
+    threads.push_back(max);
+  }
+  if (opt.reps < 1 || opt.warmup < 0 || threads.empty()) {
+    std::cerr << "bench: bad repetitions, warm-ups or threads\n";
+    return 1;
+  }
+
+  std::FILE* csv = std::fopen(opt.csv.c_str(), "a");
+  if (csv == nullptr) {
+    std::cerr << "bench: cannot open " << opt.csv << "\n";
+    return 1;
+  }
+  if (std::ftell(csv) == 0)
+    std::fprintf(csv, "code,compiler,flags,type,kernel,n,l,m,threads,warmup,reps,median_s,p95_s,min_s,gflops,relerr,ok\n");
+  std::printf("%-20s %-6s %-16s %7s %10s %10s %10s %10s %4s\n",
+              "kernel", "type", "N x L x M", "threads", "median (s)", "p95 (s)", "GFLOP/s", "rel err", "ok");
+
+  int fails{0};
+  try {
+    for (const auto& type : split(opt.types)) {
+      if (type == "double")
+        fails += bench_type<double>(opt, threads, csv);
+      else if (type == "float")
+        fails += bench_type<float>(opt, threads, csv);
+      else
+        throw std::invalid_argument{"bad type " + type};
+    }
+  } catch (const std::invalid_argument& e) {
+    std::cerr << "bench: " << e.what() << "\n";
+    std::fclose(csv);
+    return 1;
+  }
+  std::fclose(csv);
+  if (fails)
+    std::cerr << "bench: " << fails << " result(s) off the reference by more than the tolerance\n";
+  return fails != 0;
+}
+
+static void usage(std::ostream &os, const char *prog) {
+  os << "usage: " << prog << " [-h] [-t] [-r] [-p] [-a] [-s SIZES] [-k KERNELS] [-T THREADS] [-y TYPES] [-w N] [-n N] [-o FILE]\n"
+     << "  -h  print this help\n"
+     << "  -t  tune the tiles, loop order and threads of the tiled kernels\n"
+     << "  -r  measure the roofline and place the kernels on it\n"
+     << "  -p  as -r, also reading the hardware counters\n"
+     << "  -a  error of mmp_recursive and Strassen-Winograd against mmp_serial\n"
+     << "without -t, -r, -p or -a the kernels are benchmarked:\n"
+     << "  -s  sizes, N or NxLxM separated by commas, default " << bench_sizes << "\n"
+     << "  -k  kernels separated by commas, default all\n"
+     << "  -T  thread counts separated by commas, default 1, 2, 4 ... OMP_NUM_THREADS\n"
+     << "  -y  element types separated by commas, default double,float\n"
+     << "  -w  untimed warm-up runs, default 1\n"
+     << "  -n  timed runs, default 5\n"
+     << "  -o  CSV file the results are appended to, default " << bench_csv << "\n";
+}
+
+int main(int argc, char **argv) {
+  bool roof{false}, counters{false}, acc{false}, autotune{false};
+  bench_opt bopt;
+  int opt;
+  while ((opt = getopt(argc, argv, "hrpats:k:T:y:w:n:o:")) != -1) {
+    switch (opt) {
+    case 'h':
+      usage(std::cout, argv[0]);
+      return 0;
+    case 't':
+      autotune = true;
+      break;
+    case 'a':
+      acc = true;
+      break;
+    case 'r':
+      roof = true;
+      break;
+    case 'p':
+      roof = counters = true;
+      break;
+    case 's':
+      bopt.sizes = optarg;
+      break;
+    case 'k':
+      bopt.kernels = optarg;
+      break;
+    case 'T':
+      bopt.threads = optarg;
+      break;
+    case 'y':
+      bopt.types = optarg;
+      break;
+    case 'w':
+      bopt.warmup = std::atoi(optarg);
+      break;
+    case 'n':
+      bopt.reps = std::atoi(optarg);
+      break;
+    case 'o':
+      bopt.csv = optarg;
+      break;
+    default:
+      usage(std::cerr, argv[0]);
+      return 1;
+    }
+  }
+
+    int nthreads;
+  #pragma omp parallel
+  #pragma omp master
+    nthreads = omp_get_num_threads();   ;
+    std::cout << "Number of Threads: " << nthreads << "\n";
+  if (!(autotune || roof || acc))
+    return bench(bopt);
+
   constexpr auto n{1024};
   constexpr auto m{1024};
   constexpr auto l{1024};
@@ -32,11 +424,6 @@ int main() {
   mtl::Matrix<double> a{n, l};
   mtl::Matrix<double> b{l, m};
   #endif
-    int nthreads;
-  #pragma omp parallel
-  #pragma omp master
-    nthreads = omp_get_num_threads();   ;
-    std::cout << "Number of Threads: " << nthreads << "\n";
 
   #pragma omp parallel
   {
@@ -54,31 +441,10 @@ int main() {
       for (std::size_t c = 0; c < b.num_cols(); ++c)
         b(r,c) = uniform(generator);
   }
-  auto t0 = wtime();
-  auto c0 = mmp_serial(a,b);
-  t0 = wtime() - t0;
-/*
-  auto t1{omp_get_wtime()};
-  auto c1 = mmp_parallel(a,b);
-  t1 = wtime() - t1;
-
-  auto t2{omp_get_wtime()};
-  auto c2 = mmp_parallel_blocks(a,b);
-  t2 = wtime() - t2;
-
-  auto t3{omp_get_wtime()};
-  auto c3 = mmp_parallel_tiled(a,b);
-  t3 = wtime() - t3;
-  
-  std::cout << "t0 == " << t0 << "\nt1 == " << t1 << "\nt2 == " << t2 << "\nt3 == " << t3 << "\n";
-  std::cout << "c0 == c1? " << strbool(c0==c1) << "\n";
-  std::cout << "c0 == c2? " << strbool(c0==c2) << "\n";
-  std::cout << "c0 == c3? " << strbool(c0==c3) << "\n";
-  std::cout << "c1 == c2? " << strbool(c1==c2) << "\n";
-  std::cout << "c1 == c3? " << strbool(c1==c3) << "\n";
-  std::cout << "c2 == c3? " << strbool(c2==c3) << "\n";
-*/
+  if (autotune) tune(a, b);
+  if (autotune && (roof || acc)) std::cout << "\n";
+  if (roof) roofline(a, b, nthreads, counters);
+  if (roof && acc) std::cout << "\n";
+  if (acc) accuracy(a, b);
   return 0;
 }
-
-
@@ -8,9 +8,30 @@
 #include <vector>
 #include <stdexcept>
 #include <concepts>
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#include "autotune.h"
+
+// width in bytes of the vector registers the GEMM microkernel is blocked for
+#if defined(__AVX512F__)
+#define MTL_VECTOR_BYTES 64
+#elif defined(__AVX__)
+#define MTL_VECTOR_BYTES 32
+#else
+#define MTL_VECTOR_BYTES 16
+#endif
 
 namespace mtl {
 
+  // base of the nodes of lazy matrix expressions, see MatrixSum below
+  struct matrix_expr_tag {};
+
+  template<typename E>
+  concept matrix_expr = std::is_base_of_v<matrix_expr_tag, std::remove_cvref_t<E>>;
+
   template<std::floating_point T>
   class Matrix {
 
@@ -26,11 +47,21 @@ namespace mtl {
     constexpr Matrix& operator=(const Matrix &) = default;
     constexpr Matrix& operator=(Matrix &&) = default;
     constexpr ~Matrix() = default;
+
+    // evaluate an expression such as A*B + C or alpha*A + B
+    template<matrix_expr E> Matrix(const E& e);
+    template<matrix_expr E> Matrix& operator=(const E& e);
+    template<matrix_expr E> Matrix& operator+=(const E& e);
+    template<matrix_expr E> Matrix& operator-=(const E& e);
+    Matrix& operator+=(const Matrix& m);
+    Matrix& operator-=(const Matrix& m);
   
     constexpr inline reference operator() (std::size_t j, std::size_t i) noexcept {return data_[j * num_cols_ + i];}
     constexpr inline const_reference operator() (std::size_t j, std::size_t i) const noexcept {return data_[j * num_cols_ + i];}
     constexpr inline size_type num_rows() const noexcept {return num_rows_;}
     constexpr inline size_type num_cols() const noexcept {return num_cols_;}
+    constexpr inline T* data() noexcept {return data_.data();}
+    constexpr inline const T* data() const noexcept {return data_.data();}
     
     constexpr inline auto tol() const noexcept { 
       if constexpr(std::is_same_v<T,float>) {
@@ -42,6 +73,8 @@ namespace mtl {
 
   private:
 
+    template<matrix_expr E> void assign(const E& e, bool accumulate);
+
     size_type num_rows_;
     size_type num_cols_;
     std::vector<value_type> data_;
@@ -73,24 +106,330 @@ namespace mtl {
     return true;
   }
 
+  // Blocking of the packed GEMM, fixed at compile time for each T. The
+  // MR x NR block of C is held in MR * NR / lanes vector registers, 24 of
+  // the 32 with AVX-512 and 12 of the 16 otherwise. A KC x NR micro-panel
+  // of B stays in L1 while MC / MR micro-panels of A stream past it, the
+  // MC x KC block of A stays in L2 and the KC x NC panel of B in L3.
   template<std::floating_point T>
-  constexpr auto mmp_parallel_tiled(const Matrix<T>& A, const Matrix<T>& B) {
+  struct gemm_blocking {
+    static constexpr std::size_t lanes = MTL_VECTOR_BYTES / sizeof(T);
+    static constexpr std::size_t MR = (MTL_VECTOR_BYTES == 64) ? 12 : 6;
+    static constexpr std::size_t NR = 2 * lanes;
+    static constexpr std::size_t KC = 256;
+    static constexpr std::size_t MC = 10 * MR;
+    static constexpr std::size_t NC = 4096;
+    // largest dimension of the leaves of mmp_recursive, and smallest one
+    // a level of Strassen-Winograd is applied to in mmp_strassen
+    static constexpr std::size_t recursive_cutoff = 512;
+    static constexpr std::size_t strassen_cutoff = 4096;
+  };
+
+  struct aligned_free {
+    void operator()(void* p) const noexcept { std::free(p); }
+  };
+
+  template<typename T>
+  using aligned_array = std::unique_ptr<T[], aligned_free>;
+
+  // n elements on cache line boundaries
+  template<typename T>
+  inline aligned_array<T> make_aligned_array(std::size_t n) {
+    constexpr std::size_t line{64};
+    T* p = static_cast<T*>(std::aligned_alloc(line, std::max((n * sizeof(T) + line - 1) / line * line, line)));
+    if (!p) throw std::bad_alloc{};
+    return aligned_array<T>{p};
+  }
+
+  // A(0:mc, 0:kc) into micro-panels of MR rows, each stored k by k, the
+  // rows past mc padded with zeros
+  template<std::floating_point T>
+  inline void gemm_pack_a(std::size_t mc, std::size_t kc, const T* A, std::size_t lda, std::size_t ir, T* Ap) {
+    constexpr auto MR = gemm_blocking<T>::MR;
+    const std::size_t mr = std::min(MR, mc - ir);
+    T* p = Ap + ir * kc;
+    for (std::size_t k = 0; k < kc; ++k) {
+      for (std::size_t i = 0; i < mr; ++i) p[k * MR + i] = A[(ir + i) * lda + k];
+      for (std::size_t i = mr; i < MR; ++i) p[k * MR + i] = T{0};
+    }
+  }
+
+  // B(0:kc, 0:nc) into micro-panels of NR columns, each stored k by k,
+  // the columns past nc padded with zeros
+  template<std::floating_point T>
+  inline void gemm_pack_b(std::size_t nc, std::size_t kc, const T* B, std::size_t ldb, std::size_t jr, T* Bp) {
+    constexpr auto NR = gemm_blocking<T>::NR;
+    const std::size_t nr = std::min(NR, nc - jr);
+    T* p = Bp + jr * kc;
+    for (std::size_t k = 0; k < kc; ++k) {
+      for (std::size_t j = 0; j < nr; ++j) p[k * NR + j] = B[k * ldb + jr + j];
+      for (std::size_t j = nr; j < NR; ++j) p[k * NR + j] = T{0};
+    }
+  }
+
+  // C(0:mr, 0:nr) += alpha * Ap * Bp over kc. The accumulators have
+  // compile-time extents, so with the loops unrolled they are registers
+  // and the body is NR / lanes loads of B, MR broadcasts of A and MR *
+  // NR / lanes FMAs
+  template<std::floating_point T>
+  inline void gemm_micro(std::size_t kc, const T* __restrict Ap, const T* __restrict Bp,
+                         T* __restrict C, std::size_t ldc, std::size_t mr, std::size_t nr, T alpha) {
+    constexpr auto MR = gemm_blocking<T>::MR;
+    constexpr auto NR = gemm_blocking<T>::NR;
+    T c[MR][NR] = {};
+    #pragma GCC unroll 4
+    for (std::size_t k = 0; k < kc; ++k) {
+      #pragma GCC unroll 16
+      for (std::size_t i = 0; i < MR; ++i) {
+        const T a = Ap[k * MR + i];
+        #pragma omp simd
+        for (std::size_t j = 0; j < NR; ++j) c[i][j] += a * Bp[k * NR + j];
+      }
+    }
+    if (mr == MR && nr == NR) {
+      for (std::size_t i = 0; i < MR; ++i) {
+        #pragma omp simd
+        for (std::size_t j = 0; j < NR; ++j) C[i * ldc + j] += alpha * c[i][j];
+      }
+    } else {
+      for (std::size_t i = 0; i < mr; ++i)
+        for (std::size_t j = 0; j < nr; ++j) C[i * ldc + j] += alpha * c[i][j];
+    }
+  }
+
+  // C = alpha * A * B + beta * C for row-major A (m x k), B (k x n) and
+  // C (m x n) with leading dimensions lda, ldb and ldc. BLIS loop order:
+  // for each NC panel of B and KC slice of k, B and then A are packed by
+  // all the threads, and the (MC block, NR micro-panel) pairs are shared
+  // out among them
+  template<std::floating_point T>
+  void gemm(std::size_t m, std::size_t n, std::size_t k, T alpha, const T* A, std::size_t lda,
+            const T* B, std::size_t ldb, T beta, T* C, std::size_t ldc) {
+    using blk = gemm_blocking<T>;
+    constexpr auto MR = blk::MR, NR = blk::NR, KC = blk::KC, MC = blk::MC, NC = blk::NC;
+    if (m == 0 || n == 0) return;
+
+    const std::size_t mp = (m + MR - 1) / MR * MR;
+    const std::size_t np = (std::min(n, NC) + NR - 1) / NR * NR;
+    auto Ap = make_aligned_array<T>(mp * std::min(k, KC));
+    auto Bp = make_aligned_array<T>(np * std::min(k, KC));
+
+    #pragma omp parallel
+    {
+      #pragma omp for
+      for (std::size_t i = 0; i < m; ++i) {
+        for (std::size_t j = 0; j < n; ++j) {
+          C[i * ldc + j] = (beta == T{0}) ? T{0} : beta * C[i * ldc + j];
+        }
+      }
+      for (std::size_t jc = 0; jc < n; jc += NC) {
+        const std::size_t nc = std::min(NC, n - jc);
+        for (std::size_t pc = 0; pc < k; pc += KC) {
+          const std::size_t kc = std::min(KC, k - pc);
+          #pragma omp for nowait
+          for (std::size_t jr = 0; jr < nc; jr += NR) gemm_pack_b(nc, kc, B + pc * ldb + jc, ldb, jr, Bp.get());
+          #pragma omp for
+          for (std::size_t ir = 0; ir < m; ir += MR) gemm_pack_a(m, kc, A + pc, lda, ir, Ap.get());
+          #pragma omp for collapse(2) schedule(static)
+          for (std::size_t ic = 0; ic < m; ic += MC) {
+            for (std::size_t jr = 0; jr < nc; jr += NR) {
+              for (std::size_t ir = ic; ir < std::min(ic + MC, m); ir += MR) {
+                gemm_micro(kc, Ap.get() + ir * kc, Bp.get() + jr * kc, C + ir * ldc + jc + jr, ldc,
+                           std::min(MR, m - ir), std::min(NR, nc - jr), alpha);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  template<std::floating_point T>
+  void gemm(T alpha, const Matrix<T>& A, const Matrix<T>& B, T beta, Matrix<T>& C) {
+    if (!check_mulcompatible_size(A,B) || C.num_rows() != A.num_rows() || C.num_cols() != B.num_cols())
+      throw std::length_error{"Incompatible length matrix-matrix product"};
+    gemm(A.num_rows(), B.num_cols(), A.num_cols(), alpha, A.data(), A.num_cols(),
+         B.data(), B.num_cols(), beta, C.data(), C.num_cols());
+  }
+
+  template<std::floating_point T>
+  auto mmp_gemm(const Matrix<T>& A, const Matrix<T>& B) {
     if (!check_mulcompatible_size(A,B)) throw std::length_error{"Incompatible length matrix-matrix product"};
-    const auto Ar_blocksize = std::min(static_cast<int>(A.num_rows()), 32);
-    const auto Ac_blocksize = std::min(static_cast<int>(A.num_cols()), 32);
-    const auto Bc_blocksize = std::min(static_cast<int>(B.num_cols()), 32);
+    Matrix<T> C{A.num_rows(), B.num_cols()};
+    gemm(T{1}, A, B, T{0}, C);
+    return C;
+  }
+
+  // Z = X + alpha * Y on m x n row-major views, shared out as tasks
+  template<std::floating_point T>
+  void view_add(std::size_t m, std::size_t n, const T* X, std::size_t ldx, T alpha,
+                const T* Y, std::size_t ldy, T* Z, std::size_t ldz) {
+    #pragma omp taskloop grainsize(16)
+    for (std::size_t i = 0; i < m; ++i) {
+      #pragma omp simd
+      for (std::size_t j = 0; j < n; ++j) Z[i * ldz + j] = X[i * ldx + j] + alpha * Y[i * ldy + j];
+    }
+  }
+
+  // halve a dimension, keeping the first half a multiple of 16 if it can
+  constexpr std::size_t recursive_split(std::size_t x) {
+    const std::size_t h = x / 2 / 16 * 16;
+    return h ? h : x / 2;
+  }
+
+  template<std::floating_point T>
+  void strassen_winograd(std::size_t m, std::size_t n, std::size_t k, const T* A, std::size_t lda,
+                         const T* B, std::size_t ldb, T beta, T* C, std::size_t ldc, std::size_t strassen_min);
+
+  // C = A * B + beta * C on row-major views, cache-obliviously: the
+  // largest of m, n and k is halved until all are below the cutoff, and
+  // the leaves go to gemm (on one thread, as they run inside a parallel
+  // region). Halves of m or n write to separate parts of C and are run as
+  // tasks, halves of k one after the other. From strassen_min up, if not
+  // 0, the even sized blocks take a level of Strassen-Winograd instead
+  template<std::floating_point T>
+  void mmp_recursive(std::size_t m, std::size_t n, std::size_t k, const T* A, std::size_t lda,
+                     const T* B, std::size_t ldb, T beta, T* C, std::size_t ldc, std::size_t strassen_min) {
+    constexpr auto cutoff = gemm_blocking<T>::recursive_cutoff;
+    if (strassen_min > 0 && std::min({m, n, k}) >= strassen_min && m % 2 == 0 && n % 2 == 0 && k % 2 == 0) {
+      strassen_winograd(m, n, k, A, lda, B, ldb, beta, C, ldc, strassen_min);
+    } else if (std::max({m, n, k}) <= cutoff) {
+      gemm(m, n, k, T{1}, A, lda, B, ldb, beta, C, ldc);
+    } else if (m >= n && m >= k) {
+      const std::size_t h = recursive_split(m);
+      #pragma omp task
+      mmp_recursive(h, n, k, A, lda, B, ldb, beta, C, ldc, strassen_min);
+      mmp_recursive(m - h, n, k, A + h * lda, lda, B, ldb, beta, C + h * ldc, ldc, strassen_min);
+      #pragma omp taskwait
+    } else if (n >= k) {
+      const std::size_t h = recursive_split(n);
+      #pragma omp task
+      mmp_recursive(m, h, k, A, lda, B, ldb, beta, C, ldc, strassen_min);
+      mmp_recursive(m, n - h, k, A, lda, B + h, ldb, beta, C + h, ldc, strassen_min);
+      #pragma omp taskwait
+    } else {
+      const std::size_t h = recursive_split(k);
+      mmp_recursive(m, n, h, A, lda, B, ldb, beta, C, ldc, strassen_min);
+      mmp_recursive(m, n, k - h, A + h, lda, B + h * ldb, ldb, T{1}, C, ldc, strassen_min);
+    }
+  }
+
+  // One level of Strassen-Winograd, 7 products of half size instead of 8,
+  // in the schedule of Boyer, Dumas, Pernet and Zhou that uses the
+  // quadrants of C as workspace with three temporaries. Each product
+  // recurses with mmp_recursive, and the rounding error grows with each
+  // level, by roughly a factor of 3 to 4 in the norm
+  template<std::floating_point T>
+  void strassen_winograd(std::size_t m, std::size_t n, std::size_t k, const T* A, std::size_t lda,
+                         const T* B, std::size_t ldb, T beta, T* C, std::size_t ldc, std::size_t strassen_min) {
+    if (beta != T{0}) {
+      auto W = make_aligned_array<T>(m * n);
+      strassen_winograd(m, n, k, A, lda, B, ldb, T{0}, W.get(), n, strassen_min);
+      view_add(m, n, W.get(), n, beta, C, ldc, C, ldc);
+      return;
+    }
+    const std::size_t m2 = m / 2, n2 = n / 2, k2 = k / 2;
+    const T *A11 = A, *A12 = A + k2, *A21 = A + m2 * lda, *A22 = A21 + k2;
+    const T *B11 = B, *B12 = B + n2, *B21 = B + k2 * ldb, *B22 = B21 + n2;
+    T *C11 = C, *C12 = C + n2, *C21 = C + m2 * ldc, *C22 = C21 + n2;
+    auto X = make_aligned_array<T>(m2 * k2);
+    auto Y = make_aligned_array<T>(k2 * n2);
+    auto Z = make_aligned_array<T>(m2 * n2);
+    const T one{1};
+    auto product = [&](const T* P, std::size_t ldp, const T* Q, std::size_t ldq, T* R) {
+      mmp_recursive(m2, n2, k2, P, ldp, Q, ldq, T{0}, R, ldc, strassen_min);
+    };
+    view_add(m2, k2, A11, lda, -one, A21, lda, X.get(), k2);      // S3
+    view_add(k2, n2, B22, ldb, -one, B12, ldb, Y.get(), n2);      // T3
+    product(X.get(), k2, Y.get(), n2, C21);                       // P7
+    view_add(m2, k2, A21, lda, one, A22, lda, X.get(), k2);       // S1
+    view_add(k2, n2, B12, ldb, -one, B11, ldb, Y.get(), n2);      // T1
+    product(X.get(), k2, Y.get(), n2, C22);                       // P5
+    view_add(m2, k2, X.get(), k2, -one, A11, lda, X.get(), k2);   // S2 = S1 - A11
+    view_add(k2, n2, B22, ldb, -one, Y.get(), n2, Y.get(), n2);   // T2 = B22 - T1
+    product(X.get(), k2, Y.get(), n2, C12);                       // P6
+    view_add(m2, k2, A12, lda, -one, X.get(), k2, X.get(), k2);   // S4 = A12 - S2
+    view_add(k2, n2, Y.get(), n2, -one, B21, ldb, Y.get(), n2);   // T4 = T2 - B21
+    product(X.get(), k2, B22, ldb, C11);                          // P3
+    mmp_recursive(m2, n2, k2, A11, lda, B11, ldb, T{0}, Z.get(), n2, strassen_min);  // P1
+    view_add(m2, n2, Z.get(), n2, one, C12, ldc, C12, ldc);       // U2 = P1 + P6
+    view_add(m2, n2, C12, ldc, one, C21, ldc, C21, ldc);          // U3 = U2 + P7
+    view_add(m2, n2, C12, ldc, one, C22, ldc, C12, ldc);          // U4 = U2 + P5
+    view_add(m2, n2, C21, ldc, one, C22, ldc, C22, ldc);          // C22 = U3 + P5
+    view_add(m2, n2, C12, ldc, one, C11, ldc, C12, ldc);          // C12 = U4 + P3
+    product(A22, lda, Y.get(), n2, C11);                          // P4
+    view_add(m2, n2, C21, ldc, -one, C11, ldc, C21, ldc);         // C21 = U3 - P4
+    product(A12, lda, B21, ldb, C11);                             // P2
+    view_add(m2, n2, Z.get(), n2, one, C11, ldc, C11, ldc);       // C11 = P1 + P2
+  }
+
+  template<std::floating_point T>
+  auto mmp_recursive(const Matrix<T>& A, const Matrix<T>& B, std::size_t strassen_min = 0) {
+    if (!check_mulcompatible_size(A,B)) throw std::length_error{"Incompatible length matrix-matrix product"};
+    Matrix<T> C{A.num_rows(), B.num_cols()};
+    #pragma omp parallel
+    #pragma omp single
+    mmp_recursive(A.num_rows(), B.num_cols(), A.num_cols(), A.data(), A.num_cols(),
+                  B.data(), B.num_cols(), T{0}, C.data(), C.num_cols(), strassen_min);
+    return C;
+  }
+
+  template<std::floating_point T>
+  auto mmp_strassen(const Matrix<T>& A, const Matrix<T>& B) {
+    return mmp_recursive(A, B, gemm_blocking<T>::strassen_cutoff);
+  }
+
+  // name of T in the autotuning cache
+  template<std::floating_point T>
+  constexpr const char* tune_type() {
+    if constexpr (std::same_as<T, float>) return "float";
+    else if constexpr (std::same_as<T, double>) return "double";
+    else return "long double";
+  }
+
+  // tile sizes, loop order and threads of mmp_parallel_blocks and
+  // mmp_parallel_tiled: the defaults of autotune.h, or what the cache has
+  // for this CPU and T, read on the first call
+  template<std::floating_point T>
+  const tune_t& tuning() {
+    static const tune_t t = [] {
+      tune_t t;
+      tune_default(&t);
+      tune_load("cpp", tune_type<T>(), &t);
+      return t;
+    }();
+    return t;
+  }
+
+// the three loops over a tile, in the order given
+#define MTL_TILE_LOOPS(X, Y, Z)                                               \
+  for (std::size_t X = X##0; X < X##1; ++X)                                   \
+    for (std::size_t Y = Y##0; Y < Y##1; ++Y)                                 \
+      for (std::size_t Z = Z##0; Z < Z##1; ++Z)                               \
+        C(i, j) += A(i, k) * B(k, j);
+
+  template<std::floating_point T>
+  constexpr auto mmp_parallel_tiled(const Matrix<T>& A, const Matrix<T>& B, const tune_t& t) {
+    if (!check_mulcompatible_size(A,B)) throw std::length_error{"Incompatible length matrix-matrix product"};
+    const std::size_t Ar_blocksize = std::min(A.num_rows(), static_cast<std::size_t>(t.ar));
+    const std::size_t Ac_blocksize = std::min(A.num_cols(), static_cast<std::size_t>(t.ac));
+    const std::size_t Bc_blocksize = std::min(B.num_cols(), static_cast<std::size_t>(t.bc));
 
     Matrix<T> C{A.num_rows(), B.num_cols(), 0.0};
-    #pragma omp parallel for collapse(2) 
+    #pragma omp parallel for collapse(2) num_threads(tune_threads(&t))
     for (std::size_t ii=0; ii < A.num_rows(); ii += Ar_blocksize) {
       for (std::size_t jj=0; jj < B.num_cols(); jj += Bc_blocksize) {
         for (std::size_t kk = 0; kk < A.num_cols(); kk += Ac_blocksize) {
-          for (std::size_t i=ii; i < std::min(ii+Ar_blocksize, A.num_rows()); ++i) {
-            for (std::size_t j=jj; j < std::min(jj+Bc_blocksize, B.num_cols()); ++j) {
-              for (std::size_t k=kk; k <  std::min(kk+Ac_blocksize, A.num_cols()) ; ++k) {
-                C(i, j) += A(i, k) * B(k, j);
-              }
-            }
+          const std::size_t i0 = ii, i1 = std::min(ii+Ar_blocksize, A.num_rows());
+          const std::size_t j0 = jj, j1 = std::min(jj+Bc_blocksize, B.num_cols());
+          const std::size_t k0 = kk, k1 = std::min(kk+Ac_blocksize, A.num_cols());
+          switch (t.order) {
+          case TUNE_IKJ: MTL_TILE_LOOPS(i, k, j) break;
+          case TUNE_JIK: MTL_TILE_LOOPS(j, i, k) break;
+          case TUNE_JKI: MTL_TILE_LOOPS(j, k, i) break;
+          case TUNE_KIJ: MTL_TILE_LOOPS(k, i, j) break;
+          case TUNE_KJI: MTL_TILE_LOOPS(k, j, i) break;
+          default:       MTL_TILE_LOOPS(i, j, k) break;
           }
         }
       }
@@ -98,8 +437,15 @@ namespace mtl {
     return C;
   }
 
+#undef MTL_TILE_LOOPS
+
   template<std::floating_point T>
-  constexpr auto mmp_parallel_blocks(const Matrix<T>& A, const Matrix<T>& B) {
+  constexpr auto mmp_parallel_tiled(const Matrix<T>& A, const Matrix<T>& B) {
+    return mmp_parallel_tiled(A, B, tuning<T>());
+  }
+
+  template<std::floating_point T>
+  constexpr auto mmp_parallel_blocks(const Matrix<T>& A, const Matrix<T>& B, const tune_t& t) {
     if (!check_mulcompatible_size(A,B)) throw std::length_error{"Incompatible length matrix-matrix product"};
 
     Matrix<T> D{B.num_cols(), B.num_rows()};
@@ -110,9 +456,9 @@ namespace mtl {
       }
     }
     Matrix<T> C{A.num_rows(), B.num_cols(), 0.0};
-    const auto Ar_blocksize = std::min(static_cast<int>(A.num_rows()), 32);
-    const auto Bc_blocksize = std::min(static_cast<int>(B.num_cols()), 32);
-    #pragma omp parallel for collapse(2) 
+    const std::size_t Ar_blocksize = std::min(A.num_rows(), static_cast<std::size_t>(t.ar));
+    const std::size_t Bc_blocksize = std::min(B.num_cols(), static_cast<std::size_t>(t.bc));
+    #pragma omp parallel for collapse(2) num_threads(tune_threads(&t))
     for (std::size_t ii=0; ii < A.num_rows(); ii += Ar_blocksize) {
       for (std::size_t jj=0; jj < B.num_cols(); jj += Bc_blocksize) {
         for (std::size_t i=ii; i < std::min(ii+Ar_blocksize, A.num_rows()); ++i) {
@@ -130,6 +476,11 @@ namespace mtl {
     return C;
   }
 
+  template<std::floating_point T>
+  constexpr auto mmp_parallel_blocks(const Matrix<T>& A, const Matrix<T>& B) {
+    return mmp_parallel_blocks(A, B, tuning<T>());
+  }
+
   template<std::floating_point T>
   constexpr auto mmp_parallel(const Matrix<T>& A, const Matrix<T>& B) {
     if (!check_mulcompatible_size(A,B)) throw std::length_error{"Incompatible length matrix-matrix product"};
@@ -161,7 +512,250 @@ namespace mtl {
     }
     return C;
   }
+
+  // Lazy matrix expressions. A + B, A - B, -A, alpha * A and A * B only
+  // build a tree of nodes, and nothing is computed until the tree is
+  // assigned to a Matrix (or added to one with += or -=). Then all the
+  // sums and scalings are done in one fused pass over the result, and
+  // each product is added in place by gemm, so D = A*B + C costs a copy
+  // of C and one gemm, with no temporaries. Temporaries are only made for
+  // a product of expressions, (A + B) * C, and when the result is also an
+  // operand of a product. The nodes hold matrices by reference, so an
+  // expression must not outlive the statement it is written in.
+
+  template<typename E>
+  struct is_matrix : std::false_type {};
+
+  template<std::floating_point T>
+  struct is_matrix<Matrix<T>> : std::true_type {};
+
+  template<typename E>
+  concept matrix_operand = is_matrix<std::remove_cvref_t<E>>::value || matrix_expr<E>;
+
+  template<typename E>
+  using operand_value_t = typename std::remove_cvref_t<E>::value_type;
+
+  // a Matrix as a leaf of an expression
+  template<std::floating_point T>
+  class MatrixRef : public matrix_expr_tag {
+  public:
+    using value_type = T;
+    static constexpr bool has_elementwise = true;
+    constexpr MatrixRef(const Matrix<T>& m) noexcept : m_{m} {}
+    constexpr std::size_t num_rows() const noexcept {return m_.num_rows();}
+    constexpr std::size_t num_cols() const noexcept {return m_.num_cols();}
+    constexpr T elem(std::size_t i, std::size_t j) const noexcept {return m_(i, j);}
+    constexpr void add_products(Matrix<T>&, T, bool&) const noexcept {}
+    constexpr bool aliases(const T*) const noexcept {return false;}
+    constexpr bool reads(const T* p) const noexcept {return m_.data() == p;}
+    constexpr const Matrix<T>& matrix() const noexcept {return m_;}
+  private:
+    const Matrix<T>& m_;
+  };
+
+  // matrices are wrapped in a MatrixRef, nodes are copied
+  template<matrix_operand E>
+  constexpr auto make_operand(const E& e) {
+    if constexpr (is_matrix<E>::value) return MatrixRef<typename E::value_type>{e};
+    else return e;
+  }
+
+  template<matrix_operand E>
+  using operand_t = decltype(make_operand(std::declval<const std::remove_cvref_t<E>&>()));
+
+  // lhs + rhs
+  template<matrix_expr L, matrix_expr R>
+  class MatrixSum : public matrix_expr_tag {
+  public:
+    using value_type = typename L::value_type;
+    static constexpr bool has_elementwise = L::has_elementwise || R::has_elementwise;
+    MatrixSum(const L& lhs, const R& rhs) : lhs_{lhs}, rhs_{rhs} {
+      if (lhs_.num_rows() != rhs_.num_rows() || lhs_.num_cols() != rhs_.num_cols())
+        throw std::length_error{"Incompatible length matrix-matrix sum"};
+    }
+    constexpr std::size_t num_rows() const noexcept {return lhs_.num_rows();}
+    constexpr std::size_t num_cols() const noexcept {return lhs_.num_cols();}
+    constexpr value_type elem(std::size_t i, std::size_t j) const noexcept {
+      return lhs_.elem(i, j) + rhs_.elem(i, j);
+    }
+    void add_products(Matrix<value_type>& D, value_type scale, bool& first) const {
+      lhs_.add_products(D, scale, first);
+      rhs_.add_products(D, scale, first);
+    }
+    constexpr bool aliases(const value_type* p) const noexcept {return lhs_.aliases(p) || rhs_.aliases(p);}
+    constexpr bool reads(const value_type* p) const noexcept {return lhs_.reads(p) || rhs_.reads(p);}
+  private:
+    L lhs_;
+    R rhs_;
+  };
+
+  // alpha * e
+  template<matrix_expr E>
+  class MatrixScaled : public matrix_expr_tag {
+  public:
+    using value_type = typename E::value_type;
+    static constexpr bool has_elementwise = E::has_elementwise;
+    constexpr MatrixScaled(value_type alpha, const E& e) : alpha_{alpha}, e_{e} {}
+    constexpr std::size_t num_rows() const noexcept {return e_.num_rows();}
+    constexpr std::size_t num_cols() const noexcept {return e_.num_cols();}
+    constexpr value_type elem(std::size_t i, std::size_t j) const noexcept {return alpha_ * e_.elem(i, j);}
+    void add_products(Matrix<value_type>& D, value_type scale, bool& first) const {
+      e_.add_products(D, scale * alpha_, first);
+    }
+    constexpr bool aliases(const value_type* p) const noexcept {return e_.aliases(p);}
+    constexpr bool reads(const value_type* p) const noexcept {return e_.reads(p);}
+    constexpr value_type alpha() const noexcept {return alpha_;}
+    constexpr const E& operand() const noexcept {return e_;}
+  private:
+    value_type alpha_;
+    E e_;
+  };
+
+  template<typename E>
+  struct is_matrix_scaled : std::false_type {};
+
+  template<matrix_expr E>
+  struct is_matrix_scaled<MatrixScaled<E>> : std::true_type {};
+
+  // lhs * rhs, no elementwise part: it is added to the result by gemm.
+  // Scalings of the operands go into the alpha of gemm, and an operand
+  // that is not then a plain matrix is evaluated first
+  template<matrix_expr L, matrix_expr R>
+  class MatrixProduct : public matrix_expr_tag {
+  public:
+    using value_type = typename L::value_type;
+    static constexpr bool has_elementwise = false;
+    MatrixProduct(const L& lhs, const R& rhs) : lhs_{lhs}, rhs_{rhs} {
+      if (lhs_.num_cols() != rhs_.num_rows())
+        throw std::length_error{"Incompatible length matrix-matrix product"};
+    }
+    constexpr std::size_t num_rows() const noexcept {return lhs_.num_rows();}
+    constexpr std::size_t num_cols() const noexcept {return rhs_.num_cols();}
+    constexpr value_type elem(std::size_t, std::size_t) const noexcept {return value_type{0};}
+    void add_products(Matrix<value_type>& D, value_type scale, bool& first) const {
+      gemm(scale * scale_of(lhs_) * scale_of(rhs_), evaluate(lhs_), evaluate(rhs_),
+           first ? value_type{0} : value_type{1}, D);
+      first = false;
+    }
+    constexpr bool aliases(const value_type* p) const noexcept {return lhs_.reads(p) || rhs_.reads(p);}
+    constexpr bool reads(const value_type* p) const noexcept {return lhs_.reads(p) || rhs_.reads(p);}
+  private:
+    template<matrix_expr E>
+    static value_type scale_of(const E& e) {
+      if constexpr (is_matrix_scaled<E>::value) return e.alpha() * scale_of(e.operand());
+      else return value_type{1};
+    }
+    template<matrix_expr E>
+    static decltype(auto) evaluate(const E& e) {
+      if constexpr (std::is_same_v<E, MatrixRef<value_type>>) return e.matrix();
+      else if constexpr (is_matrix_scaled<E>::value) return evaluate(e.operand());
+      else return Matrix<value_type>(e);
+    }
+    L lhs_;
+    R rhs_;
+  };
+
+  template<matrix_operand L, matrix_operand R>
+    requires std::same_as<operand_value_t<L>, operand_value_t<R>>
+  constexpr auto operator+(const L& lhs, const R& rhs) {
+    return MatrixSum<operand_t<L>, operand_t<R>>{make_operand(lhs), make_operand(rhs)};
+  }
+
+  template<matrix_operand E>
+  constexpr auto operator*(std::type_identity_t<operand_value_t<E>> alpha, const E& e) {
+    return MatrixScaled<operand_t<E>>{alpha, make_operand(e)};
+  }
+
+  template<matrix_operand E>
+  constexpr auto operator*(const E& e, std::type_identity_t<operand_value_t<E>> alpha) {
+    return alpha * e;
+  }
+
+  template<matrix_operand E>
+  constexpr auto operator-(const E& e) {
+    return operand_value_t<E>{-1} * e;
+  }
+
+  template<matrix_operand L, matrix_operand R>
+    requires std::same_as<operand_value_t<L>, operand_value_t<R>>
+  constexpr auto operator-(const L& lhs, const R& rhs) {
+    return lhs + (-rhs);
+  }
+
+  template<matrix_operand L, matrix_operand R>
+    requires std::same_as<operand_value_t<L>, operand_value_t<R>>
+  constexpr auto operator*(const L& lhs, const R& rhs) {
+    return MatrixProduct<operand_t<L>, operand_t<R>>{make_operand(lhs), make_operand(rhs)};
+  }
+
+  // the fused pass over the elementwise part, then the products
+  template<std::floating_point T>
+  template<matrix_expr E>
+  void Matrix<T>::assign(const E& e, bool accumulate) {
+    bool first = !accumulate;
+    if constexpr (E::has_elementwise) {
+      T* d = data_.data();
+      #pragma omp parallel for
+      for (std::size_t i = 0; i < num_rows_; ++i) {
+        if (accumulate) {
+          #pragma omp simd
+          for (std::size_t j = 0; j < num_cols_; ++j) d[i * num_cols_ + j] += e.elem(i, j);
+        } else {
+          #pragma omp simd
+          for (std::size_t j = 0; j < num_cols_; ++j) d[i * num_cols_ + j] = e.elem(i, j);
+        }
+      }
+      first = false;
+    }
+    e.add_products(*this, T{1}, first);
+  }
+
+  template<std::floating_point T>
+  template<matrix_expr E>
+  Matrix<T>::Matrix(const E& e) : Matrix(e.num_rows(), e.num_cols()) {
+    assign(e, false);
+  }
+
+  template<std::floating_point T>
+  template<matrix_expr E>
+  Matrix<T>& Matrix<T>::operator=(const E& e) {
+    if (num_rows_ != e.num_rows() || num_cols_ != e.num_cols() || e.aliases(data_.data())) {
+      *this = Matrix(e);
+    } else {
+      assign(e, false);
+    }
+    return *this;
+  }
+
+  template<std::floating_point T>
+  template<matrix_expr E>
+  Matrix<T>& Matrix<T>::operator+=(const E& e) {
+    if (num_rows_ != e.num_rows() || num_cols_ != e.num_cols())
+      throw std::length_error{"Incompatible length matrix-matrix sum"};
+    if (e.aliases(data_.data())) {
+      const Matrix tmp(e);
+      assign(MatrixRef<T>{tmp}, true);
+    } else {
+      assign(e, true);
+    }
+    return *this;
+  }
+
+  template<std::floating_point T>
+  template<matrix_expr E>
+  Matrix<T>& Matrix<T>::operator-=(const E& e) {
+    return *this += T{-1} * e;
+  }
+
+  template<std::floating_point T>
+  Matrix<T>& Matrix<T>::operator+=(const Matrix& m) {
+    return *this += MatrixRef<T>{m};
+  }
+
+  template<std::floating_point T>
+  Matrix<T>& Matrix<T>::operator-=(const Matrix& m) {
+    return *this -= MatrixRef<T>{m};
+  }
 }
 
 #endif
-
@@ -0,0 +1,364 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <omp.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "roofline.h"
+
+/* width in bytes of the vector registers the FMA kernel runs on */
+#if defined(__AVX512F__)
+#define ROOF_VEC 64
+#elif defined(__AVX__)
+#define ROOF_VEC 32
+#else
+#define ROOF_VEC 16
+#endif
+
+/* independent accumulators, enough to hide the FMA latency on two ports
+   while staying within 16 registers */
+#define ROOF_NACC   12
+#define ROOF_NITER  20000000LL
+#define ROOF_NTRIAL 5
+/* bytes each thread moves per trial of the triad */
+#define ROOF_BYTES  2e9
+
+static const char *roof_level[ROOF_MAXLEVEL] = {"L1", "L2", "L3", "DRAM"};
+
+/* results of the kernels go here so the compiler cannot drop them */
+static volatile double roof_sink;
+
+/*
+ * x = x*a + b on ROOF_NACC independent vectors. Compiled for the native
+ * target this is one vfmadd per vector per iteration and nothing else,
+ * so the rate is the peak of the FMA units.
+ */
+#define ROOF_FMA(name, vec_t, real_t)                            \
+static double name(long long niter)                              \
+{                                                                \
+  vec_t x[ROOF_NACC];                                            \
+  vec_t a = (vec_t){} + (real_t)0.999999;                        \
+  vec_t b = (vec_t){} + (real_t)1e-6;                            \
+  double sum = 0;                                                \
+  for (int k = 0; k < ROOF_NACC; ++k)                            \
+    x[k] = (vec_t){} + (real_t)k / ROOF_NACC;                    \
+  for (long long it = 0; it < niter; ++it) {                     \
+    _Pragma("GCC unroll 16")                                     \
+    for (int k = 0; k < ROOF_NACC; ++k)                          \
+      x[k] = x[k] * a + b;                                       \
+  }                                                              \
+  for (int k = 0; k < ROOF_NACC; ++k)                            \
+    for (unsigned v = 0; v < ROOF_VEC / sizeof(real_t); ++v)     \
+      sum += x[k][v];                                            \
+  return sum;                                                    \
+}
+
+typedef double roof_vd __attribute__ ((vector_size (ROOF_VEC)));
+typedef float  roof_vs __attribute__ ((vector_size (ROOF_VEC)));
+
+ROOF_FMA(roof_fma_dp, roof_vd, double)
+ROOF_FMA(roof_fma_sp, roof_vs, float)
+
+/* best GFLOP/s of nthreads threads each running the FMA kernel */
+static double roof_peak(int nthreads, int sp) {
+  const long long lanes = ROOF_VEC / (sp ? sizeof(float) : sizeof(double));
+  const double flops = 2.0 * ROOF_NACC * lanes * ROOF_NITER * nthreads;
+  double best = 0, t0 = 0;
+  #pragma omp parallel num_threads(nthreads)
+  {
+    for (int trial = 0; trial < ROOF_NTRIAL; ++trial) {
+      #pragma omp barrier
+      #pragma omp single
+      t0 = omp_get_wtime();
+      double s = sp ? roof_fma_sp(ROOF_NITER) : roof_fma_dp(ROOF_NITER);
+      #pragma omp atomic
+      roof_sink += s;
+      #pragma omp barrier
+      #pragma omp single
+      {
+        double g = flops / (omp_get_wtime() - t0) * 1e-9;
+        if (g > best) best = g;
+      }
+    }
+  }
+  return best;
+}
+
+/*
+ * STREAM triad a = b + s*c over three private arrays per thread that
+ * together take bytes, swapping a and b after every pass. Counted as
+ * STREAM does, 3 words a point and no write allocate. Best GB/s of all
+ * the threads together.
+ */
+static double roof_triad(long long bytes, int nthreads) {
+  const long long n = bytes / (3 * sizeof(double)) / 8 * 8;
+  const long long reps = (ROOF_BYTES / bytes > 2) ? ROOF_BYTES / bytes : 2;
+  const size_t alloc = (n * sizeof(double) + ROOF_LINE - 1) / ROOF_LINE * ROOF_LINE;
+  double best = 0, t0 = 0;
+  #pragma omp parallel num_threads(nthreads)
+  {
+    double * a = aligned_alloc(ROOF_LINE, alloc);
+    double * b = aligned_alloc(ROOF_LINE, alloc);
+    double * c = aligned_alloc(ROOF_LINE, alloc);
+    for (long long i = 0; i < n; ++i) {
+      a[i] = 1.0;
+      b[i] = 2.0;
+      c[i] = 1e-3;
+    }
+    for (int trial = 0; trial < ROOF_NTRIAL; ++trial) {
+      #pragma omp barrier
+      #pragma omp single
+      t0 = omp_get_wtime();
+      for (long long r = 0; r < reps; ++r) {
+        #pragma omp simd aligned(a, b, c : ROOF_LINE)
+        for (long long i = 0; i < n; ++i)
+          a[i] = b[i] + 0.5 * c[i];
+        double * t = a; a = b; b = t;
+      }
+      #pragma omp barrier
+      #pragma omp single
+      {
+        double g = 3.0 * sizeof(double) * n * reps * nthreads / (omp_get_wtime() - t0) * 1e-9;
+        if (g > best) best = g;
+      }
+    }
+    #pragma omp atomic
+    roof_sink += b[n / 2];
+    free(a); free(b); free(c);
+  }
+  return best;
+}
+
+static long long roof_cache_size(int name, long long dflt) {
+  long long z = sysconf(name);
+  return (z > 0) ? z : dflt;
+}
+
+/*
+ * Measure the roofs with nthreads threads. The triad of a cache level
+ * uses half its capacity (shared by the threads for L3), and the one of
+ * DRAM four times the L3, at least 256 MiB and at most 2 GiB in all.
+ */
+void roof_measure(roof_t *roof, int nthreads) {
+  memset(roof, 0, sizeof(*roof));
+  roof->nthreads = nthreads;
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+  roof->cache[ROOF_L1] = roof_cache_size(_SC_LEVEL1_DCACHE_SIZE, 32 << 10);
+  roof->cache[ROOF_L2] = roof_cache_size(_SC_LEVEL2_CACHE_SIZE, 1 << 20);
+  roof->cache[ROOF_L3] = roof_cache_size(_SC_LEVEL3_CACHE_SIZE, 32 << 20);
+#else
+  roof->cache[ROOF_L1] = 32 << 10;
+  roof->cache[ROOF_L2] = 1 << 20;
+  roof->cache[ROOF_L3] = 32 << 20;
+#endif
+  long long dram = 4 * roof->cache[ROOF_L3];
+  if (dram < (256LL << 20)) dram = 256LL << 20;
+  if (dram > (2LL << 30)) dram = 2LL << 30;
+  roof->size[ROOF_L1]   = roof->cache[ROOF_L1] / 2;
+  roof->size[ROOF_L2]   = roof->cache[ROOF_L2] / 2;
+  roof->size[ROOF_L3]   = roof->cache[ROOF_L3] / 2 / nthreads;
+  roof->size[ROOF_DRAM] = dram / nthreads;
+
+  roof->peak_dp = roof_peak(nthreads, 0);
+  roof->peak_sp = roof_peak(nthreads, 1);
+  for (int lv = 0; lv < ROOF_MAXLEVEL; ++lv)
+    roof->bw[lv] = roof_triad(roof->size[lv], nthreads);
+}
+
+void roof_print(const roof_t *roof) {
+  printf("Roofs with %d thread(s)\n", roof->nthreads);
+  printf("  peak DP %9.2f GFLOP/s, SP %9.2f GFLOP/s\n", roof->peak_dp, roof->peak_sp);
+  printf("  %-5s %12s %12s %10s %10s %10s\n", "level", "cache (B)", "set (B)", "GB/s", "ridge DP", "ridge SP");
+  for (int lv = 0; lv < ROOF_MAXLEVEL; ++lv) {
+    char cache[32] = "-";
+    if (roof->cache[lv] > 0) snprintf(cache, sizeof(cache), "%lld", roof->cache[lv]);
+    printf("  %-5s %12s %12lld %10.2f %10.3f %10.3f\n", roof_level[lv], cache,
+           roof->size[lv], roof->bw[lv], roof->peak_dp / roof->bw[lv], roof->peak_sp / roof->bw[lv]);
+  }
+}
+
+double roof_flops(const roof_kernel_t *k) {
+  return 2.0 * k->n * k->l * k->m;
+}
+
+/*
+ * Bytes a matrix product moves through a cache of z bytes, in a simple
+ * reuse model and not a cache simulation: an operand is reused if its
+ * working set fits, otherwise it is streamed again. z = 0 gives the
+ * loads and stores issued by the core, the traffic of L1 in the
+ * cache-aware roofline.
+ */
+double roof_traffic(const roof_kernel_t *k, double z) {
+  const double n = k->n, l = k->l, m = k->m, s = k->size, b = k->block;
+  /* words of C, and of the transpose of B into D */
+  const double c = n * m * (1 + k->cread);
+  const double t = (k->kind == ROOF_TRANSPOSED) ? 2 * l * m : 0;
+
+  if (k->kind == ROOF_PACKED) {
+    /* the packing reads A and B and writes and reads them back once;
+       the reuse of the packed panels is taken to be all in cache */
+    const double p = 3 * (n * l + l * m);
+    if (z == 0) return s * (2 * n * l * m / b + c + p);
+    return s * (p + c);
+  }
+  if (z == 0) {
+    if (k->rmw) return s * (4 * n * l * m + t);
+    return s * (2 * n * l * m + c + t);
+  }
+  if (s * (n * l + l * m + n * m + t / 2) <= z)
+    return s * (n * l + l * m + c + t);
+
+  switch (k->kind) {
+  case ROOF_IJK:
+    /* the row of A and the l lines under a column of B are reused
+       across j, else each element of B brings in a line of its own */
+    if (s * l + ROOF_LINE * l <= z) return s * (n * l + n * l * m + c);
+    return s * (n * l + c) + ROOF_LINE * n * l * m;
+  case ROOF_TRANSPOSED:
+    /* a block of rows of A meets all of D, so D streams once a block */
+    if (2 * b * l * s <= z) return s * (n * l + n / b * l * m + c + t);
+    return s * (n * l + n * l * m + c + t);
+  case ROOF_TILED: {
+    /* the C tile stays over kk, the row of A tiles over jj, and B
+       streams once per row of tiles */
+    double a  = (s * (b * l + 2 * b * b) <= z) ? n * l : n * l * m / b;
+    double cc = (3 * b * b * s <= z) ? c : 2 * n * m * l / b;
+    return s * (a + n / b * l * m + cc);
+  }
+  }
+  return 0;
+}
+
+/*
+ * Place each kernel on the roofline: its arithmetic intensity at every
+ * level, the lowest roof over it, and how close it gets. Kernels on one
+ * thread are held against roof1 and the others against roofn. The cache
+ * capacities are those of one core for L1 and L2.
+ */
+void roof_report(const roof_t *roof1, const roof_t *roofn, const roof_kernel_t *k, int nk) {
+  printf("%-22s %4s %9s %8s %8s %8s %8s %6s %9s %7s %7s\n", "kernel", "thr", "GFLOP/s",
+         "AI L1", "AI L2", "AI L3", "AI DRAM", "bound", "roof", "%roof", "%peak");
+  for (int i = 0; i < nk; ++i) {
+    const roof_t *roof = (k[i].nthreads > 1) ? roofn : roof1;
+    const double peak = (k[i].size == sizeof(float)) ? roof->peak_sp : roof->peak_dp;
+    const double flops = roof_flops(&k[i]);
+    const double gflops = flops / k[i].time * 1e-9;
+    double ai[ROOF_MAXLEVEL];
+    double top = peak;
+    const char *bound = "FMA";
+    for (int lv = 0; lv < ROOF_MAXLEVEL; ++lv) {
+      ai[lv] = flops / roof_traffic(&k[i], lv == ROOF_L1 ? 0 : roof->cache[lv - 1]);
+      if (ai[lv] * roof->bw[lv] < top) {
+        top = ai[lv] * roof->bw[lv];
+        bound = roof_level[lv];
+      }
+    }
+    printf("%-22s %4d %9.2f %8.3f %8.3f %8.3f %8.3f %6s %9.2f %6.1f%% %6.1f%%\n", k[i].name,
+           k[i].nthreads, gflops, ai[ROOF_L1], ai[ROOF_L2], ai[ROOF_L3], ai[ROOF_DRAM], bound,
+           top, 100 * gflops / top, 100 * gflops / peak);
+    if (k[i].count.ok) {
+      const roof_counters_t *c = &k[i].count;
+      printf("%-22s      IPC %.2f, LLC misses %lld, measured AI DRAM %.3f\n", "",
+             c->cycles ? (double)c->instructions / c->cycles : 0.0, c->llc_misses,
+             c->llc_misses ? flops / ((double)c->llc_misses * ROOF_LINE) : 0.0);
+    }
+  }
+}
+
+/*
+ * Hardware counters of every OpenMP thread, opened by the thread itself
+ * so that the pool threads are counted too. The kernels measured between
+ * start and stop must run with the same number of threads.
+ */
+#define ROOF_NCOUNTER 3
+
+static int (*roof_fd)[ROOF_NCOUNTER] = NULL;
+static int roof_nfd = 0;
+
+#ifdef __linux__
+static int roof_perf_open(unsigned long long config) {
+  struct perf_event_attr pe;
+  memset(&pe, 0, sizeof(pe));
+  pe.type = PERF_TYPE_HARDWARE;
+  pe.size = sizeof(pe);
+  pe.config = config;
+  pe.disabled = 1;
+  pe.exclude_kernel = 1;
+  pe.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+}
+#endif
+
+/* returns 0 if the counters of all threads are running */
+int roof_counters_start(void) {
+#ifdef __linux__
+  const unsigned long long config[ROOF_NCOUNTER] = {PERF_COUNT_HW_CPU_CYCLES,
+                                                    PERF_COUNT_HW_INSTRUCTIONS,
+                                                    PERF_COUNT_HW_CACHE_MISSES};
+  int fail = 0;
+  roof_nfd = omp_get_max_threads();
+  roof_fd = malloc(sizeof(*roof_fd) * roof_nfd);
+  #pragma omp parallel num_threads(roof_nfd) reduction(+:fail)
+  {
+    int t = omp_get_thread_num();
+    for (int e = 0; e < ROOF_NCOUNTER; ++e) {
+      roof_fd[t][e] = roof_perf_open(config[e]);
+      if (roof_fd[t][e] < 0) ++fail;
+    }
+  }
+  if (fail) {
+    roof_counters_stop(NULL);
+    return 1;
+  }
+  #pragma omp parallel num_threads(roof_nfd)
+  {
+    int t = omp_get_thread_num();
+    for (int e = 0; e < ROOF_NCOUNTER; ++e) {
+      ioctl(roof_fd[t][e], PERF_EVENT_IOC_RESET, 0);
+      ioctl(roof_fd[t][e], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+/* stop, read and close the counters; count may be NULL to discard them */
+void roof_counters_stop(roof_counters_t *count) {
+  long long sum[ROOF_NCOUNTER] = {0, 0, 0};
+  int ok = (roof_fd != NULL);
+#ifdef __linux__
+  if (roof_fd != NULL) {
+    #pragma omp parallel num_threads(roof_nfd) reduction(+:sum[:ROOF_NCOUNTER]) reduction(&&:ok)
+    {
+      int t = omp_get_thread_num();
+      for (int e = 0; e < ROOF_NCOUNTER; ++e) {
+        long long v = 0;
+        if (roof_fd[t][e] < 0) {
+          ok = 0;
+          continue;
+        }
+        ioctl(roof_fd[t][e], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(roof_fd[t][e], &v, sizeof(v)) != sizeof(v)) ok = 0;
+        sum[e] += v;
+        close(roof_fd[t][e]);
+      }
+    }
+    free(roof_fd);
+    roof_fd = NULL;
+  }
+#endif
+  if (count != NULL) {
+    count->ok = ok;
+    count->cycles = sum[0];
+    count->instructions = sum[1];
+    count->llc_misses = sum[2];
+  }
+}
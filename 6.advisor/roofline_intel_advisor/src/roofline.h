@@ -0,0 +1,69 @@
+#ifndef ROOFLINE_H
+#define ROOFLINE_H
+
+/*
+ * Roofline without Intel Advisor: the peak FLOP/s of the core is measured
+ * with an FMA microkernel and the bandwidth of each level of the memory
+ * hierarchy with a STREAM triad sized to fit in it. The matrix products
+ * are placed on the roofline with an analytic model of their flops and of
+ * the bytes that reach every level; optionally the hardware counters are
+ * read with perf_event_open to check the model.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ROOF_MAXLEVEL 4
+#define ROOF_LINE     64
+
+enum { ROOF_L1, ROOF_L2, ROOF_L3, ROOF_DRAM };
+
+/* loop structure of a matrix product, for the traffic model */
+enum { ROOF_IJK, ROOF_TRANSPOSED, ROOF_TILED, ROOF_PACKED };
+
+typedef struct {
+  int nthreads;
+  double peak_dp;                    /* GFLOP/s */
+  double peak_sp;
+  long long cache[ROOF_MAXLEVEL];    /* capacity in bytes, 0 for DRAM */
+  long long size[ROOF_MAXLEVEL];     /* bytes streamed by each thread */
+  double bw[ROOF_MAXLEVEL];          /* GB/s */
+} roof_t;
+
+typedef struct {
+  int ok;
+  long long cycles;
+  long long instructions;
+  long long llc_misses;
+} roof_counters_t;
+
+typedef struct {
+  const char *name;
+  int kind;             /* ROOF_IJK, ROOF_TRANSPOSED, ROOF_TILED or ROOF_PACKED */
+  int block;            /* tile edge of the blocked kernels; for ROOF_PACKED
+                           the flops per word loaded in the microkernel,
+                           2 MR NR / (MR + NR) */
+  int rmw;              /* C(i,j) is loaded and stored in the innermost loop */
+  int cread;            /* C is an input, C += A*B */
+  int nthreads;
+  long long n, l, m;    /* C(n x m) = A(n x l) * B(l x m) */
+  int size;             /* bytes of an element */
+  double time;          /* seconds */
+  roof_counters_t count;
+} roof_kernel_t;
+
+void   roof_measure(roof_t *roof, int nthreads);
+void   roof_print(const roof_t *roof);
+double roof_flops(const roof_kernel_t *k);
+double roof_traffic(const roof_kernel_t *k, double z);
+void   roof_report(const roof_t *roof1, const roof_t *roofn, const roof_kernel_t *k, int nk);
+
+int    roof_counters_start(void);
+void   roof_counters_stop(roof_counters_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif